@@ -287,6 +287,13 @@ class TaskTarget(FreestandingCppTarget):
     def __init__(self, name, location, args):
         super().__init__(name, location, args)
 
+    # The kernel saves and restores the FPU and SSE registers of tasks, so
+    # their own code may use them. Libraries are shared with the kernel and
+    # are still built without.
+    def kernel_c_flags(self):
+        disabled = ['-mno-mmx', '-mno-sse', '-mno-sse2']
+        return [f for f in super().kernel_c_flags() if f not in disabled]
+
     def is_up_to_date(self):
         if not super().is_up_to_date():
             return False
@@ -0,0 +1,117 @@
+#ifndef min_heap_h
+#define min_heap_h
+
+#include "assertions.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// A binary min-heap of at most kCapacity pointers to T. The heap doesn't own
+// the elements. Traits provides:
+//
+//   static uint64_t Key(const T* item);  // Smallest key is on top.
+//   static int& Index(T* item);          // Storage for the position in the heap.
+//
+// The index is -1 while the item is not in any heap, so items can be removed
+// or have their keys changed in O(log n).
+template<typename T, typename Traits, size_t kCapacity>
+class MinHeap {
+public:
+  bool IsEmpty() const { return size_ == 0; }
+  bool IsFull() const { return size_ == kCapacity; }
+  size_t size() const { return size_; }
+
+  static bool Contains(T* item) {
+    return Traits::Index(item) >= 0;
+  }
+
+  // The items in heap order, which is no particular order past the first.
+  T* At(size_t index) const {
+    assert_lt(index, size_);
+    return items_[index];
+  }
+
+  T* Top() const {
+    assert_gt(size_, 0);
+    return items_[0];
+  }
+
+  void Push(T* item) {
+    assert_lt(size_, kCapacity);
+    assert(!Contains(item));
+    items_[size_] = item;
+    Traits::Index(item) = size_;
+    size_++;
+    SiftUp(size_ - 1);
+  }
+
+  T* Pop() {
+    T* top = Top();
+    Remove(top);
+    return top;
+  }
+
+  void Remove(T* item) {
+    int index = Traits::Index(item);
+    assert_ge(index, 0);
+    assert_eq(items_[index], item);
+
+    size_--;
+    if (size_t(index) != size_) {
+      Place(index, items_[size_]);
+      Update(items_[index]);
+    }
+    items_[size_] = nullptr;
+    Traits::Index(item) = -1;
+  }
+
+  // Restores the heap order after the key of |item| changed.
+  void Update(T* item) {
+    int index = Traits::Index(item);
+    assert_ge(index, 0);
+    if (!SiftUp(index)) {
+      SiftDown(index);
+    }
+  }
+
+private:
+  void Place(size_t index, T* item) {
+    items_[index] = item;
+    Traits::Index(item) = index;
+  }
+
+  // Returns true if the item moved.
+  bool SiftUp(size_t index) {
+    T* item = items_[index];
+    uint64_t key = Traits::Key(item);
+    size_t start = index;
+    while (index > 0) {
+      size_t parent = (index - 1) / 2;
+      if (Traits::Key(items_[parent]) <= key) break;
+      Place(index, items_[parent]);
+      index = parent;
+    }
+    Place(index, item);
+    return index != start;
+  }
+
+  void SiftDown(size_t index) {
+    T* item = items_[index];
+    uint64_t key = Traits::Key(item);
+    for (;;) {
+      size_t child = 2 * index + 1;
+      if (child >= size_) break;
+      if (child + 1 < size_ && Traits::Key(items_[child + 1]) < Traits::Key(items_[child])) {
+        child++;
+      }
+      if (key <= Traits::Key(items_[child])) break;
+      Place(index, items_[child]);
+      index = child;
+    }
+    Place(index, item);
+  }
+
+  T* items_[kCapacity] = {};
+  size_t size_ = 0;
+};
+
+#endif
@@ -0,0 +1,94 @@
+#include "min_heap.h"
+#include "gtest/gtest.h"
+
+#include <vector>
+
+struct TestItem {
+  uint64_t key;
+  int heap_index = -1;
+
+  TestItem(uint64_t k) : key(k) {}
+};
+
+struct TestItemTraits {
+  static uint64_t Key(const TestItem* item) { return item->key; }
+  static int& Index(TestItem* item) { return item->heap_index; }
+};
+
+typedef MinHeap<TestItem, TestItemTraits, 16> TestHeap;
+
+TEST(MinHeapTest, PopsInOrder) {
+  TestHeap heap;
+  EXPECT_TRUE(heap.IsEmpty());
+
+  TestItem items[] = {5, 3, 9, 1, 7, 3, 8};
+  for (TestItem& item : items) {
+    heap.Push(&item);
+  }
+  EXPECT_EQ(heap.size(), 7u);
+
+  uint64_t last = 0;
+  while (!heap.IsEmpty()) {
+    TestItem* item = heap.Pop();
+    EXPECT_LE(last, item->key);
+    EXPECT_EQ(item->heap_index, -1);
+    last = item->key;
+  }
+  EXPECT_EQ(last, 9u);
+}
+
+TEST(MinHeapTest, Full) {
+  TestHeap heap;
+  std::vector<TestItem> items;
+  for (uint64_t i = 0; i < 16; i++) {
+    items.emplace_back(16 - i);
+  }
+  for (TestItem& item : items) {
+    EXPECT_FALSE(heap.IsFull());
+    heap.Push(&item);
+  }
+  EXPECT_TRUE(heap.IsFull());
+  EXPECT_EQ(heap.Top()->key, 1u);
+
+  heap.Pop();
+  EXPECT_FALSE(heap.IsFull());
+}
+
+TEST(MinHeapTest, Remove) {
+  TestHeap heap;
+  TestItem a(4), b(2), c(6), d(1);
+  heap.Push(&a);
+  heap.Push(&b);
+  heap.Push(&c);
+  heap.Push(&d);
+
+  heap.Remove(&b);
+  EXPECT_FALSE(TestHeap::Contains(&b));
+  EXPECT_EQ(heap.size(), 3u);
+
+  heap.Remove(&d);
+  EXPECT_EQ(heap.Top(), &a);
+
+  heap.Remove(&c);
+  heap.Remove(&a);
+  EXPECT_TRUE(heap.IsEmpty());
+}
+
+TEST(MinHeapTest, Update) {
+  TestHeap heap;
+  TestItem a(10), b(20), c(30);
+  heap.Push(&a);
+  heap.Push(&b);
+  heap.Push(&c);
+  EXPECT_EQ(heap.Top(), &a);
+
+  c.key = 5;
+  heap.Update(&c);
+  EXPECT_EQ(heap.Top(), &c);
+
+  c.key = 25;
+  heap.Update(&c);
+  EXPECT_EQ(heap.Pop(), &a);
+  EXPECT_EQ(heap.Pop(), &b);
+  EXPECT_EQ(heap.Pop(), &c);
+}
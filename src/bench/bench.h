@@ -0,0 +1,70 @@
+#ifndef bench_h
+#define bench_h
+
+#include "base/output_stream.h"
+#include "base/types.h"
+#include "usr/system.h"
+
+class DebugOutputStream : public OutputStream {
+public:
+  void OutputChar(char c) override {
+    SysWriteByte(c);
+  }
+};
+
+inline uint64_t ReadCycles() {
+  uint32_t low, high;
+  asm volatile("rdtsc" : "=a"(low), "=d"(high));
+  return (uint64_t(high) << 32) | low;
+}
+
+// The benchmarks of bench_grub.cfg take turns, so that none is measured
+// while another competes for the CPU. Each calls BeginBenchmark before it
+// starts and EndBenchmark once it printed its results, and bench_runner ends
+// the run after the last one. Servers they talk to don't take part.
+
+// Must match bench_grub.cfg.
+static const int kBenchRunnerTid = 26;
+static const int kNumBenchmarks = 4;
+
+enum {
+  kMsgBeginBenchmark = 1,
+  kMsgEndBenchmark,
+};
+
+// Waits until no other benchmark is running.
+inline void BeginBenchmark() {
+  Message msg;
+  msg.set_tag(kMsgBeginBenchmark, 0);
+  SysCall(kBenchRunnerTid, &msg);
+}
+
+inline void EndBenchmark() {
+  Message msg;
+  msg.set_tag(kMsgEndBenchmark, 0);
+  SysSendMessage(kBenchRunnerTid, &msg);
+}
+
+// Shell sort, so benchmarks can take percentiles of a few thousand samples
+// without a C library.
+inline void SortSamples(uint64_t* samples, size_t count) {
+  size_t gap = 1;
+  while (gap < count / 3) gap = gap * 3 + 1;
+  for (; gap > 0; gap /= 3) {
+    for (size_t i = gap; i < count; i++) {
+      uint64_t sample = samples[i];
+      size_t j = i;
+      for (; j >= gap && samples[j - gap] > sample; j -= gap) {
+        samples[j] = samples[j - gap];
+      }
+      samples[j] = sample;
+    }
+  }
+}
+
+// |samples| must be sorted.
+inline uint64_t Percentile(const uint64_t* samples, size_t count, int percent) {
+  return samples[(count - 1) * percent / 100];
+}
+
+#endif  // bench_h
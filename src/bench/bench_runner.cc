@@ -0,0 +1,45 @@
+#include "base/io.h"
+#include "bench/bench.h"
+
+// Lets the benchmarks of bench_grub.cfg run one at a time, in the order they
+// ask, and ends the run once all of them are done. See BeginBenchmark.
+
+// The port and value don't matter as long as they match the isa-debug-exit
+// device on the QEMU command line in mk.
+static const unsigned short kDebugExitPort = 0xf4;
+
+extern "C" {
+void _start() {
+  // Callers waiting in BeginBenchmark, first come, first served.
+  int waiting[kNumBenchmarks];
+  int num_waiting = 0;
+
+  int running = 0;
+  int finished = 0;
+  while (finished < kNumBenchmarks) {
+    Message msg;
+    int sender = SysReceiveMessage(&msg);
+    if (msg.type() == kMsgBeginBenchmark && num_waiting < kNumBenchmarks) {
+      waiting[num_waiting++] = sender;
+    } else if (msg.type() == kMsgEndBenchmark && sender == running) {
+      running = 0;
+      finished++;
+    }
+
+    if (!running && num_waiting) {
+      running = waiting[0];
+      num_waiting--;
+      for (int i = 0; i < num_waiting; i++) {
+        waiting[i] = waiting[i + 1];
+      }
+
+      Message go;
+      go.set_tag(kMsgBeginBenchmark, 0);
+      SysSendMessage(running, &go);
+    }
+  }
+
+  outb(kDebugExitPort, 0);
+  SysExitThread();
+}
+}
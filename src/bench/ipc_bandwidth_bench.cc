@@ -0,0 +1,67 @@
+#include "bench/bench.h"
+
+// Measures long message throughput to ipc_sink at a range of sizes. Buffers
+// of kShareThreshold bytes or more are measured twice: page aligned, which
+// lets the kernel share the pages, and off by a few bytes, which makes it
+// copy them.
+
+static const int kSinkTid = 20;
+
+static const size_t kMaxSize = 256 * 1024;
+static const size_t kUnalignedOffset = 64;
+static char send_buffer[kMaxSize + kPageSize] __attribute__((aligned(kPageSize)));
+
+static const size_t kSizes[] = {
+  64, 512, 4096, 16 * 1024, 64 * 1024, 256 * 1024,
+};
+
+static const int kWarmupIterations = 100;
+
+// Returns the average number of cycles per round trip.
+static uint64_t Measure(const char* buffer, size_t size, int iterations) {
+  Message msg;
+  for (int i = 0; i < kWarmupIterations; i++) {
+    msg.SetLong(0, buffer, size);
+    SysCall(kSinkTid, &msg);
+  }
+
+  uint64_t start = ReadCycles();
+  for (int i = 0; i < iterations; i++) {
+    msg.SetLong(0, buffer, size);
+    SysCall(kSinkTid, &msg);
+  }
+  uint64_t cycles = (ReadCycles() - start) / iterations;
+
+  if (msg.words[0] != size) {
+    DebugOutputStream().Printf("ipc_bandwidth_bench: only %u of %u bytes arrived\n",
+                               unsigned(msg.words[0]), unsigned(size));
+  }
+  return cycles;
+}
+
+static void Report(const char* mode, size_t size, uint64_t cycles) {
+  DebugOutputStream().Printf("ipc_bandwidth_bench: %u bytes (%s): %u cycles, %u bytes/kcycle\n",
+                             unsigned(size), mode, unsigned(cycles),
+                             unsigned(size * 1000 / (cycles ? cycles : 1)));
+}
+
+extern "C" {
+void _start() {
+  BeginBenchmark();
+  for (size_t i = 0; i < sizeof(send_buffer); i++) {
+    send_buffer[i] = char(i);
+  }
+
+  for (size_t size : kSizes) {
+    int iterations = size < kShareThreshold ? 10000 : 1000;
+
+    Report("copy", size, Measure(send_buffer + kUnalignedOffset, size, iterations));
+    if (size >= kShareThreshold) {
+      Report("share", size, Measure(send_buffer, size, iterations));
+    }
+  }
+
+  EndBenchmark();
+  SysExitThread();
+}
+}
@@ -0,0 +1,120 @@
+#include "bench/bench.h"
+
+// Many clients calling one server at once. A few of the clients are urgent;
+// with send queues ordered by priority, their round trips should stay short
+// however many background clients are queued with them.
+//
+// The server takes only work requests until all of it is done, so the
+// results the clients send as they finish pile up in its send queue and
+// exercise the filtered receive.
+
+// Must match bench_grub.cfg.
+static const int kServerTid = 22;
+
+static const int kNumUrgentClients = 2;
+static const int kNumBackgroundClients = 14;
+static const int kNumClients = kNumUrgentClients + kNumBackgroundClients;
+static const int kCallsPerClient = 2000;
+
+static const int kUrgentPriority = 16;
+static const int kBackgroundPriority = 40;
+
+// How long the server works on each request.
+static const uint64_t kWorkCycles = 2000;
+
+enum {
+  kMsgWork = 1,
+  kMsgResult,
+};
+
+static void ClientMain(uint64_t* arg) {
+  bool urgent = *arg;
+
+  uint64_t total = 0, max = 0;
+  for (int i = 0; i < kCallsPerClient; i++) {
+    Message msg;
+    msg.set_tag(kMsgWork, 0);
+
+    uint64_t start = ReadCycles();
+    SysCall(kServerTid, &msg);
+    uint64_t cycles = ReadCycles() - start;
+
+    total += cycles;
+    if (cycles > max) max = cycles;
+  }
+
+  Message result;
+  result.set_tag(kMsgResult, 3);
+  result.words[0] = urgent;
+  result.words[1] = total;
+  result.words[2] = max;
+  SysSendMessage(kServerTid, &result);
+
+  SysExitThread();
+}
+
+struct Totals {
+  uint64_t cycles = 0;
+  uint64_t max = 0;
+  int clients = 0;
+
+  void Add(const Message& result) {
+    cycles += result.words[1];
+    if (result.words[2] > max) max = result.words[2];
+    clients++;
+  }
+
+  void Print(const char* name) {
+    uint64_t calls = uint64_t(clients) * kCallsPerClient;
+    DebugOutputStream().Printf("ipc_fanin_bench: %s clients: %u cycles average, %u max round trip\n",
+                               name, unsigned(calls ? cycles / calls : 0), unsigned(max));
+  }
+};
+
+extern "C" {
+void _start() {
+  BeginBenchmark();
+
+  // Background clients first, so the urgent ones find a queue to jump.
+  for (int i = 0; i < kNumClients; i++) {
+    bool urgent = i >= kNumBackgroundClients;
+    SysCreateThread(&ClientMain, urgent ? kUrgentPriority : kBackgroundPriority, urgent);
+  }
+
+  uint64_t start = ReadCycles();
+
+  Message reply;
+  reply.set_tag(kMsgWork, 0);
+  for (int i = 0; i < kNumClients * kCallsPerClient; i++) {
+    Message msg;
+    int client = SysReceiveMessageFiltered(&msg, 0, kMsgWork, kNoTimeout);
+
+    uint64_t work_start = ReadCycles();
+    while (ReadCycles() - work_start < kWorkCycles) {}
+
+    SysSendMessage(client, &reply);
+  }
+
+  uint64_t elapsed = ReadCycles() - start;
+
+  Totals urgent, background;
+  for (int i = 0; i < kNumClients; i++) {
+    Message result;
+    SysReceiveMessageFiltered(&result, 0, kMsgResult, kNoTimeout);
+    if (result.words[0]) {
+      urgent.Add(result);
+    } else {
+      background.Add(result);
+    }
+  }
+
+  urgent.Print("urgent");
+  background.Print("background");
+  DebugOutputStream().Printf("ipc_fanin_bench: %u requests from %d clients in %u cycles each\n",
+                             unsigned(kNumClients * kCallsPerClient), kNumClients,
+                             unsigned(elapsed / (kNumClients * kCallsPerClient)));
+
+  EndBenchmark();
+  SysExitThread();
+}
+}
@@ -0,0 +1,28 @@
+#include "bench/bench.h"
+
+// The receiving end of ipc_bandwidth_bench. Replies to every message with the
+// number of bytes that arrived.
+
+static const size_t kReceiveBufferSize = 256 * 1024;
+static char receive_buffer[kReceiveBufferSize] __attribute__((aligned(kPageSize)));
+
+extern "C" {
+void _start() {
+  SysSetReceiveBuffer(receive_buffer, kReceiveBufferSize);
+
+  Message msg;
+  int sender = SysReceiveMessage(&msg);
+  for (;;) {
+    Message reply;
+    reply.set_tag(0, 1);
+    if (msg.is_long()) {
+      reply.words[0] = msg.buffer_size();
+      if (msg.is_shared()) {
+        SysUnmapShared(msg.buffer(), msg.buffer_size());
+      }
+    }
+
+    sender = SysReplyWait(sender, &reply, &msg);
+  }
+}
+}
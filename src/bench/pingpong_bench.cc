@@ -0,0 +1,59 @@
+#include "bench/bench.h"
+
+// Times SysCall round trips to a thread in the same address space and to one
+// in another, and prints the median and 99th percentile in cycles. Each round
+// trip is two switches between threads, so the difference between the two is
+// roughly twice the cost of changing address spaces.
+
+// Must match bench_grub.cfg.
+static const int kServerTid = 24;
+
+static const int kPriority = 48;
+
+static const int kWarmupRoundTrips = 1000;
+static const int kRoundTrips = 10000;
+
+static uint64_t samples[kRoundTrips];
+
+static void PongMain(uint64_t*) {
+  Message msg;
+  int sender = SysReceiveMessage(&msg);
+  for (;;) {
+    sender = SysReplyWait(sender, &msg, &msg);
+  }
+}
+
+static void RunPingPong(const char* name, int tid) {
+  Message msg;
+  for (int i = 0; i < kWarmupRoundTrips; i++) {
+    msg.set_tag(0, 1);
+    SysCall(tid, &msg);
+  }
+
+  for (int i = 0; i < kRoundTrips; i++) {
+    msg.set_tag(0, 1);
+    msg.words[0] = i;
+
+    uint64_t start = ReadCycles();
+    SysCall(tid, &msg);
+    samples[i] = ReadCycles() - start;
+  }
+
+  SortSamples(samples, kRoundTrips);
+  DebugOutputStream().Printf("pingpong_bench: %s: %d round trips, p50 %u cycles, p99 %u cycles\n",
+                             name, kRoundTrips,
+                             unsigned(Percentile(samples, kRoundTrips, 50)),
+                             unsigned(Percentile(samples, kRoundTrips, 99)));
+}
+
+extern "C" {
+void _start() {
+  BeginBenchmark();
+  int pong_tid = SysCreateThread(&PongMain, kPriority, 0);
+  RunPingPong("same address space", pong_tid);
+  RunPingPong("cross address space", kServerTid);
+
+  EndBenchmark();
+  SysExitThread();
+}
+}
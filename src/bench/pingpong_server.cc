@@ -0,0 +1,14 @@
+#include "bench/bench.h"
+
+// The far end of pingpong_bench's cross address space round trips. Replies to
+// every call with the message it got.
+
+extern "C" {
+void _start() {
+  Message msg;
+  int sender = SysReceiveMessage(&msg);
+  for (;;) {
+    sender = SysReplyWait(sender, &msg, &msg);
+  }
+}
+}
@@ -0,0 +1,33 @@
+#include "bench/bench.h"
+
+static const int kWarmupIterations = 1000;
+static const int kIterations = 100000;
+
+// Returns the average number of cycles per call of |fn|.
+static uint64_t Measure(void (*fn)()) {
+  for (int i = 0; i < kWarmupIterations; i++) {
+    fn();
+  }
+
+  uint64_t start = ReadCycles();
+  for (int i = 0; i < kIterations; i++) {
+    fn();
+  }
+  return (ReadCycles() - start) / kIterations;
+}
+
+extern "C" {
+void _start() {
+  BeginBenchmark();
+  DebugOutputStream stream;
+
+  uint64_t int80 = Measure(&SysNopInt80);
+  uint64_t syscall = Measure(&SysNop);
+
+  stream.Printf("syscall_bench: null syscall: int 0x80 = %u cycles, syscall = %u cycles\n",
+                unsigned(int80), unsigned(syscall));
+
+  EndBenchmark();
+  SysExitThread();
+}
+}
@@ -5,6 +5,7 @@
 #include "drivers/console/raster_frame_buffer.h"
 #include "drivers/console/text_frame_buffer.h"
 #include "drivers/console/emulator.h"
+#include "usr/channel.h"
 #include "usr/system.h"
 
 // Line discipline: You put characters from the keyboard (or whatever) into it.
@@ -143,12 +144,31 @@ void _start(KernelModuleData* module_data) {
   em.GetCursorPosition(&x, &y);
   fb.MoveCursor(x, y);
 
-  for (;;) {
-    int sender, type;
-    uint64_t payload;
-    SysReceive(&sender, &type, &payload);
+  // Every word of a message is one character.
+  auto output = [&em](const Message& msg) {
+    for (int i = 0; i < msg.length() && i < kMaxMessageWords; i++) {
+      em.Input(msg.words[i]);
+    }
+  };
+
+  // Output can also come through a channel, one writer at a time. A thread
+  // that opens one takes over from the last.
+  ChannelReader channel;
 
-    em.Input(payload);
+  for (;;) {
+    Message msg;
+    int sender = SysReceiveMessage(&msg);
+
+    if (sender == 0) {
+      // The doorbell. Take everything written since the last one.
+      if (msg.words[0] & kChannelDoorbell) {
+        while (channel.is_attached() && channel.Read(&msg)) {
+          output(msg);
+        }
+      }
+    } else if (!channel.Attach(sender, msg)) {
+      output(msg);
+    }
 
     int x, y;
     em.GetCursorPosition(&x, &y);
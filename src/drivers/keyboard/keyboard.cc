@@ -2,6 +2,7 @@
 #include "base/io.h"
 #include "base/output_stream.h"
 #include "base/types.h"
+#include "usr/batch.h"
 #include "usr/keyboard.h"
 #include "usr/system.h"
 
@@ -110,6 +111,10 @@ ScanCodeInfo g_scancodes[] = {
 
 static const int kNumScanCodes = sizeof(g_scancodes) / sizeof(g_scancodes[0]);
 
+// The reply to a waiting reader and the interrupt acknowledgement go to the
+// kernel together.
+static BatchRing g_batch_ring __attribute__((aligned(kPageSize)));
+
 static void DescribeKey(const KeyInfo& info, OutputStream* stream) {
   switch (info.type) {
     case kTypeError:
@@ -298,6 +303,7 @@ void _start() {
   LOG(INFO).Printf("keyboard: Starting up!");
 
   SysRequestInterrupt(1);
+  Batch batch(&g_batch_ring);
 
   bool escaped = false;
   bool shift = false;
@@ -307,21 +313,38 @@ void _start() {
   uint64_t buffer[kBufferSize];
   int buffer_start = 0, buffer_end = 0;
 
+  // Threads waiting for a key, served first come, first served.
   static const int kMaxRequests = 8;
   int requestors[kMaxRequests];
-  int num_requests = 0;
+  int requests_start = 0, num_requests = 0;
+
+  // A reply to send on the next trip into the kernel.
+  int reply_to = 0;
+  Message reply;
+  reply.set_tag(kMsgReadReply, 1);
 
   for (;;) {
-    int sender, type;
-    uint64_t payload;
-    SysReceive(&sender, &type, &payload);
+    Message msg;
+    int sender;
+    if (reply_to) {
+      sender = SysReplyWait(reply_to, &reply, &msg);
+      reply_to = 0;
+    } else {
+      sender = SysReceiveMessage(&msg);
+    }
 
     if (sender) {
       LOG(DEBUG).Printf("keyboard: Got key request");
       if (buffer_start == buffer_end) {
-        requestors[num_requests++] = sender;
+        if (num_requests < kMaxRequests) {
+          requestors[(requests_start + num_requests) % kMaxRequests] = sender;
+          num_requests++;
+        } else {
+          LOG(WARNING).Printf("keyboard: Too many readers, ignoring %d", sender);
+        }
       } else {
-        SysSend(sender, kMsgReadReply, buffer[buffer_start]);
+        reply_to = sender;
+        reply.words[0] = buffer[buffer_start];
         buffer_start = (buffer_start + 1) % kBufferSize;
       }
 
@@ -375,9 +398,13 @@ void _start() {
       uint64_t formatted = event.Format();
 
       if (num_requests) {
+        int recipient = requestors[requests_start];
+        requests_start = (requests_start + 1) % kMaxRequests;
         num_requests--;
-        int recipient = requestors[num_requests];
-        SysSend(recipient, kMsgReadReply, formatted);
+        Message key_msg;
+        key_msg.set_tag(kMsgReadReply, 1);
+        key_msg.words[0] = formatted;
+        batch.Send(recipient, key_msg, 0, /*quiet=*/ true);
       } else {
         buffer[buffer_end] = formatted;
         buffer_end = (buffer_end + 1) % kBufferSize;
@@ -409,7 +436,8 @@ void _start() {
       }
     }
 
-    SysAckInterrupt(1);
+    batch.AckInterrupt(1, 0, /*quiet=*/ true);
+    batch.Submit();
 
     //Delay();
   }
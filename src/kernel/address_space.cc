@@ -8,7 +8,26 @@
 
 static const virt_addr_t kStackBase = virt_addr_t(0x7ffffffff000);
 
-AddressSpace::AddressSpace() {
+// Pages shared by other address spaces go here, one range after the other.
+// Virtual space is never reused.
+static const virt_addr_t kSharedBase = virt_addr_t(0x600000000000);
+static const virt_addr_t kSharedEnd = virt_addr_t(0x700000000000);
+
+static void InvalidatePage(virt_addr_t virt) {
+  asm volatile("invlpg (%0)" : : "r"(virt) : "memory");
+}
+
+static virt_addr_t PageStart(virt_addr_t addr) {
+  return addr & ~virt_addr_t(kPageSize - 1);
+}
+
+static virt_addr_t PageEnd(virt_addr_t addr) {
+  return PageStart(addr + kPageSize - 1);
+}
+
+AddressSpace::AddressSpace()
+  : next_stack_top_(kStackBase),
+    next_shared_(kSharedBase) {
   const size_t kMaxRAMSize = 64 * (uint64_t(1) << 30);
   page_tables_.Map(0, kMaxRAMSize, g_kernel_virtual_start, g_kernel_virtual_start + kMaxRAMSize, PageAttributes());
 }
@@ -17,12 +36,17 @@ Thread* AddressSpace::CreateThread(virt_addr_t start_func, int priority,
                                    void* stack_data, size_t stack_data_len) {
   const int kStackPages = 4;
 
+  // Each thread gets its own stack below the previous one, with an unmapped
+  // guard page in between.
+  virt_addr_t stack_top = next_stack_top_;
+  next_stack_top_ -= (kStackPages + 1) * kPageSize;
+
   PageAttributes stack_attrs;
   stack_attrs.set_no_execute(true);
   phys_addr_t top_stack_page;
   for (int i = 0; i < kStackPages; i++) {
     phys_addr_t page = g_frame_allocator->AllocateFrame();
-    virt_addr_t virt = kStackBase - (i + 1) * kPageSize;
+    virt_addr_t virt = stack_top - (i + 1) * kPageSize;
     Map(page, page + kPageSize, virt, virt + kPageSize, stack_attrs);
 
     if (i == 0) {
@@ -30,7 +54,7 @@ Thread* AddressSpace::CreateThread(virt_addr_t start_func, int priority,
     }
   }
 
-  virt_addr_t stack_base = kStackBase;
+  virt_addr_t stack_base = stack_top;
   if (stack_data_len) {
     assert_lt(stack_data_len, kPageSize);
     stack_base -= stack_data_len;
@@ -41,7 +65,7 @@ Thread* AddressSpace::CreateThread(virt_addr_t start_func, int priority,
 
   PageAttributes guard_attrs;
   guard_attrs.set_present(false);
-  virt_addr_t virt = kStackBase - (kStackPages + 1) * kPageSize;
+  virt_addr_t virt = stack_top - (kStackPages + 1) * kPageSize;
   Map(0, 0, virt, virt + kPageSize, guard_attrs);
 
   return new Thread(start_func, stack_base, RefPtr<AddressSpace>(this), priority);
@@ -53,5 +77,139 @@ void AddressSpace::Map(phys_addr_t phys_start, phys_addr_t phys_end,
   page_tables_.Map(phys_start, phys_end, virt_start, virt_end, attrs);
 }
 
+bool AddressSpace::Unmap(virt_addr_t start, virt_addr_t end) {
+  if (start < kSharedBase || end > next_shared_ || start >= end) {
+    return false;
+  }
+
+  start = PageStart(start);
+  end = PageEnd(end);
+
+  PageAttributes attrs;
+  attrs.set_present(false);
+  Map(0, 0, start, end, attrs);
+
+  for (virt_addr_t virt = start; virt < end; virt += kPageSize) {
+    InvalidatePage(virt);
+  }
+  g_scheduler->ShootDownTlb(this);
+
+  return true;
+}
+
+bool AddressSpace::Translate(virt_addr_t virt, phys_addr_t* phys, PageAttributes* attrs) const {
+  if (virt >= g_kernel_virtual_start) {
+    return false;
+  }
+
+  PageAttributes page_attrs;
+  if (!page_tables_.Translate(virt, phys, &page_attrs) || !page_attrs.user_accessible()) {
+    return false;
+  }
+
+  if (attrs) {
+    *attrs = page_attrs;
+  }
+  return true;
+}
+
+bool AddressSpace::Copy(AddressSpace* to, virt_addr_t to_addr,
+                        const AddressSpace* from, virt_addr_t from_addr, size_t size) {
+  if (to_addr + size < to_addr || from_addr + size < from_addr) {
+    return false;
+  }
+
+  // Check every page first so a failed copy leaves the destination alone.
+  phys_addr_t phys;
+  PageAttributes attrs;
+  for (virt_addr_t virt = PageStart(from_addr); virt < from_addr + size; virt += kPageSize) {
+    if (!from->Translate(virt, &phys)) return false;
+  }
+  for (virt_addr_t virt = PageStart(to_addr); virt < to_addr + size; virt += kPageSize) {
+    if (!to->Translate(virt, &phys, &attrs) || !attrs.writable()) return false;
+  }
+
+  while (size) {
+    phys_addr_t from_phys, to_phys;
+    from->Translate(from_addr, &from_phys);
+    to->Translate(to_addr, &to_phys);
+
+    // Stop at whichever page ends first.
+    size_t chunk = size;
+    size_t from_left = kPageSize - (from_addr & (kPageSize - 1));
+    size_t to_left = kPageSize - (to_addr & (kPageSize - 1));
+    if (chunk > from_left) chunk = from_left;
+    if (chunk > to_left) chunk = to_left;
+
+    memcpy(reinterpret_cast<void*>(PhysicalToVirtual(to_phys)),
+           reinterpret_cast<const void*>(PhysicalToVirtual(from_phys)), chunk);
+
+    from_addr += chunk;
+    to_addr += chunk;
+    size -= chunk;
+  }
+
+  return true;
+}
+
+bool AddressSpace::CopyOut(virt_addr_t to_addr, const void* data, size_t size) {
+  if (to_addr + size < to_addr) {
+    return false;
+  }
+
+  phys_addr_t phys;
+  PageAttributes attrs;
+  for (virt_addr_t virt = PageStart(to_addr); virt < to_addr + size; virt += kPageSize) {
+    if (!Translate(virt, &phys, &attrs) || !attrs.writable()) return false;
+  }
+
+  const char* from = static_cast<const char*>(data);
+  while (size) {
+    Translate(to_addr, &phys);
+    size_t chunk = kPageSize - (to_addr & (kPageSize - 1));
+    if (chunk > size) chunk = size;
+
+    memcpy(reinterpret_cast<void*>(PhysicalToVirtual(phys)), from, chunk);
+
+    from += chunk;
+    to_addr += chunk;
+    size -= chunk;
+  }
+
+  return true;
+}
+
+virt_addr_t AddressSpace::Share(const AddressSpace* from, virt_addr_t addr, size_t size,
+                               bool writable) {
+  virt_addr_t start = PageStart(addr);
+  virt_addr_t end = PageEnd(addr + size);
+  if (end <= start || next_shared_ + (end - start) > kSharedEnd) {
+    return 0;
+  }
+
+  phys_addr_t phys;
+  for (virt_addr_t virt = start; virt < end; virt += kPageSize) {
+    if (!from->Translate(virt, &phys)) return 0;
+  }
+
+  virt_addr_t shared = next_shared_;
+  next_shared_ += end - start;
+
+  for (virt_addr_t virt = start; virt < end; virt += kPageSize) {
+    PageAttributes attrs;
+    from->Translate(virt, &phys, &attrs);
+    phys = PageStart(phys);
+    attrs.set_global(false);
+    if (!writable) {
+      attrs.set_writable(false);
+    }
+
+    virt_addr_t to = shared + (virt - start);
+    Map(phys, phys + kPageSize, to, to + kPageSize, attrs);
+  }
+
+  return shared + (addr - start);
+}
+
 Allocator<AddressSpace>* g_address_space_allocator;
 DEFINE_ALLOCATION_METHODS(AddressSpace, g_address_space_allocator);
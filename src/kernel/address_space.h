@@ -21,10 +21,39 @@ public:
            virt_addr_t virt_start, virt_addr_t virt_end,
            const PageAttributes& attrs);
 
+  // Unmaps pages that were shared into this address space by Share.
+  // Returns false if the range is outside of the shared area.
+  bool Unmap(virt_addr_t start, virt_addr_t end);
+
+  // Like PageTableManager::Translate, but only for user addresses.
+  bool Translate(virt_addr_t virt, phys_addr_t* phys, PageAttributes* attrs = nullptr) const;
+
+  // Copies |size| bytes from |from_addr| in |from| to |to_addr| in |to|,
+  // without switching to either address space. Returns false without copying
+  // anything if a page on either side isn't mapped, or isn't writable in |to|.
+  static bool Copy(AddressSpace* to, virt_addr_t to_addr,
+                   const AddressSpace* from, virt_addr_t from_addr, size_t size);
+
+  // Copies |size| bytes of kernel memory to |to_addr|. Returns false without
+  // copying anything if a page isn't mapped writable.
+  bool CopyOut(virt_addr_t to_addr, const void* data, size_t size);
+
+  // Maps the pages holding |size| bytes at |addr| in |from| into this address
+  // space as well. Both sides see the same memory, and it stays mapped here
+  // until Unmap. Unless |writable|, this side may only read it. Returns where
+  // the pages start, or 0 if any isn't mapped.
+  virt_addr_t Share(const AddressSpace* from, virt_addr_t addr, size_t size, bool writable);
+
   DECLARE_ALLOCATION_METHODS();
 
 private:
   PageTableManager page_tables_;
+
+  // Where the stack of the next thread created in this address space ends.
+  virt_addr_t next_stack_top_;
+
+  // Where the next pages shared into this address space go.
+  virt_addr_t next_shared_;
 };
 
 extern Allocator<AddressSpace>* g_address_space_allocator;
@@ -0,0 +1,138 @@
+; -*- mode: nasm-mode; nasm-basic-offset: 2
+
+; Startup code for the application processors. smp.cc copies everything
+; between ap_trampoline_start and ap_trampoline_end to AP_TRAMPOLINE_ADDRESS,
+; fills in the variables at the end and sends the startup IPI, which makes
+; every AP start executing the copy in real mode.
+
+global ap_trampoline_start
+global ap_trampoline_end
+global ap_trampoline_boot_tables
+global ap_trampoline_kernel_tables
+global ap_trampoline_stacks
+global ap_trampoline_next_index
+global ap_trampoline_max_index
+extern ApMain
+
+  AP_TRAMPOLINE_ADDRESS equ 0x8000
+  AP_STACK_SIZE equ 16384
+
+; Address of |x| in the copy.
+%define TRAMP(x) (AP_TRAMPOLINE_ADDRESS + (x) - ap_trampoline_start)
+
+section .text
+bits 16
+ap_trampoline_start:
+  cli
+  cld
+  xor ax, ax
+  mov ds, ax
+
+  lgdt [TRAMP(ap_gdt.pointer)]
+
+  ; Enable protected mode.
+  mov eax, cr0
+  or eax, 1
+  mov cr0, eax
+
+  jmp dword ap_gdt.code32:TRAMP(ap_trampoline32)
+
+bits 32
+ap_trampoline32:
+  mov ax, ap_gdt.data
+  mov ds, ax
+  mov es, ax
+  mov ss, ax
+
+  ; Same as loader32.s:enable_paging. The boot page tables identity map the
+  ; first gigabyte, so we keep running from the copy once paging is on.
+  mov eax, cr4
+  or eax, 1 << 5
+  mov cr4, eax
+
+  mov eax, [TRAMP(ap_trampoline_boot_tables)]
+  mov cr3, eax
+
+  mov ecx, 0xC0000080
+  rdmsr
+  or eax, 1 << 8                ; long mode enabled flag
+  or eax, 1 << 11               ; NX enabled flag
+  wrmsr
+
+  mov eax, cr0
+  or eax, 1 << 31
+  mov cr0, eax
+
+  jmp ap_gdt.code64:TRAMP(ap_trampoline64)
+
+bits 64
+ap_trampoline64:
+  xor ax, ax
+  mov ss, ax
+  mov ds, ax
+  mov es, ax
+  mov fs, ax
+  mov gs, ax
+
+  ; Every AP takes the next CPU index. The BSP is index 0.
+  mov eax, 1
+  lock xadd dword [TRAMP(ap_trampoline_next_index)], eax
+  cmp eax, dword [TRAMP(ap_trampoline_max_index)]
+  jae .park
+
+  ; Each AP has its own boot stack in the kernel image.
+  mov ebx, eax
+  inc rax
+  shl rax, 14                   ; * AP_STACK_SIZE
+  add rax, qword [TRAMP(ap_trampoline_stacks)]
+  mov rsp, rax
+
+  ; Jump to the higher half. The copy is not mapped in the kernel tables.
+  mov rsi, qword [TRAMP(ap_trampoline_kernel_tables)]
+  mov rax, ap_start64
+  jmp rax
+
+.park:
+  ; More CPUs than we have room for.
+  cli
+  hlt
+  jmp .park
+
+align 8
+ap_gdt:
+  dq 0
+.code64: equ $ - ap_gdt
+  dq 0x00af9a000000ffff         ; 64-bit code segment
+.data: equ $ - ap_gdt
+  dq 0x00cf92000000ffff         ; flat data segment
+.code32: equ $ - ap_gdt
+  dq 0x00cf9a000000ffff         ; flat 32-bit code segment
+.pointer:
+  dw $ - ap_gdt - 1
+  dd TRAMP(ap_gdt)
+
+align 8
+ap_trampoline_boot_tables:
+  dq 0
+ap_trampoline_kernel_tables:
+  dq 0
+ap_trampoline_stacks:
+  dq 0
+ap_trampoline_next_index:
+  dd 0
+ap_trampoline_max_index:
+  dd 0
+ap_trampoline_end:
+
+; Not copied. Runs from the kernel image with the boot page tables.
+; rbx = CPU index, rsi = kernel page tables.
+ap_start64:
+  mov cr3, rsi
+  xor ebp, ebp
+  mov edi, ebx
+  call ApMain
+
+.hang:
+  cli
+  hlt
+  jmp .hang
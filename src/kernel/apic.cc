@@ -0,0 +1,94 @@
+#include "apic.h"
+
+#include "kernel/msr.h"
+#include "kernel/page_translation.h"
+
+static const int kApicIdRegister = 0x20;
+static const int kApicEoiRegister = 0xb0;
+static const int kApicSpuriousRegister = 0xf0;
+static const int kApicCommandLowRegister = 0x300;
+static const int kApicCommandHighRegister = 0x310;
+static const int kApicTimerLvtRegister = 0x320;
+static const int kApicTimerInitialCountRegister = 0x380;
+static const int kApicTimerCurrentCountRegister = 0x390;
+static const int kApicTimerDivideRegister = 0x3e0;
+
+static const uint32_t kApicSoftwareEnable = 1 << 8;
+static const uint32_t kApicLvtMasked = 1 << 16;
+static const uint32_t kApicTimerPeriodic = 1 << 17;
+static const uint32_t kApicTimerDivideBy16 = 0x3;
+
+static const uint32_t kApicDeliveryFixed = 0 << 8;
+static const uint32_t kApicDeliveryInit = 5 << 8;
+static const uint32_t kApicDeliveryStartup = 6 << 8;
+static const uint32_t kApicDeliveryPending = 1 << 12;
+static const uint32_t kApicLevelAssert = 1 << 14;
+static const uint32_t kApicDestinationAllButSelf = 3 << 18;
+
+static const uint64_t kApicBaseMask = ~uint64_t(kPageSize - 1);
+
+LocalApic* g_local_apic;
+
+LocalApic::LocalApic()
+  : base_(PhysicalToVirtual(ReadMsr(kApicBaseMsr) & kApicBaseMask & ((uint64_t(1) << 52) - 1))) {}
+
+bool LocalApic::IsSupported() {
+  const uint32_t kCpuidApic = 1 << 9;
+  return Cpuid(1).edx & kCpuidApic;
+}
+
+uint32_t LocalApic::Read(int reg) {
+  return *reinterpret_cast<volatile uint32_t*>(base_ + reg);
+}
+
+void LocalApic::Write(int reg, uint32_t value) {
+  *reinterpret_cast<volatile uint32_t*>(base_ + reg) = value;
+}
+
+void LocalApic::Enable() {
+  Write(kApicSpuriousRegister, kApicSoftwareEnable | kSpuriousVector);
+}
+
+void LocalApic::EndOfInterrupt() {
+  Write(kApicEoiRegister, 0);
+}
+
+uint32_t LocalApic::Id() {
+  return Read(kApicIdRegister) >> 24;
+}
+
+void LocalApic::StartTimer(int vector, uint32_t initial_count, bool periodic) {
+  Write(kApicTimerDivideRegister, kApicTimerDivideBy16);
+  Write(kApicTimerLvtRegister, vector | (periodic ? kApicTimerPeriodic : 0));
+  Write(kApicTimerInitialCountRegister, initial_count);
+}
+
+void LocalApic::StopTimer() {
+  Write(kApicTimerLvtRegister, kApicLvtMasked);
+  Write(kApicTimerInitialCountRegister, 0);
+}
+
+uint32_t LocalApic::TimerCount() {
+  return Read(kApicTimerCurrentCountRegister);
+}
+
+void LocalApic::SendCommand(uint32_t destination, uint32_t command) {
+  Write(kApicCommandHighRegister, destination << 24);
+  Write(kApicCommandLowRegister, command);
+
+  while (Read(kApicCommandLowRegister) & kApicDeliveryPending) {
+    asm volatile("pause");
+  }
+}
+
+void LocalApic::SendIpi(uint32_t apic_id, int vector) {
+  SendCommand(apic_id, kApicDeliveryFixed | kApicLevelAssert | vector);
+}
+
+void LocalApic::SendInitToOthers() {
+  SendCommand(0, kApicDestinationAllButSelf | kApicDeliveryInit | kApicLevelAssert);
+}
+
+void LocalApic::SendStartupToOthers(int start_page) {
+  SendCommand(0, kApicDestinationAllButSelf | kApicDeliveryStartup | kApicLevelAssert | start_page);
+}
@@ -0,0 +1,51 @@
+#ifndef apic_h
+#define apic_h
+
+#include "base/types.h"
+
+// The local APIC of the CPU we're running on. Its registers are memory mapped
+// at the same physical address on every CPU.
+class LocalApic {
+public:
+  LocalApic();
+
+  static bool IsSupported();
+
+  void Enable();
+  void EndOfInterrupt();
+
+  uint32_t Id();
+
+  // The timer counts down from |initial_count| at the bus frequency divided by 16.
+  void StartTimer(int vector, uint32_t initial_count, bool periodic);
+  void StopTimer();
+  uint32_t TimerCount();
+
+  // Sends a fixed interrupt to the CPU whose local APIC has |apic_id|.
+  void SendIpi(uint32_t apic_id, int vector);
+
+  // Inter-processor interrupts to every CPU except the calling one, used to
+  // start the application processors. SIPI makes them start executing in
+  // real mode at |start_page| * 4K.
+  void SendInitToOthers();
+  void SendStartupToOthers(int start_page);
+
+  // Raised on a CPU when another CPU put a thread on its run queue.
+  static const int kRescheduleVector = 49;
+
+  // Raised on a CPU whose TLB may hold pages another CPU just unmapped.
+  static const int kTlbShootdownVector = 50;
+  static const int kSpuriousVector = 0xff;
+
+private:
+  uint32_t Read(int reg);
+  void Write(int reg, uint32_t value);
+
+  void SendCommand(uint32_t destination, uint32_t command);
+
+  virt_addr_t base_;
+};
+
+extern LocalApic* g_local_apic;
+
+#endif  // apic_h
@@ -0,0 +1,68 @@
+#include "batch.h"
+
+#include "kernel/interrupts.h"
+#include "kernel/page_translation.h"
+
+static int64_t RunSubmission(Thread* thread, const BatchSubmission& op) {
+  switch (op.opcode) {
+    case kBatchSend:
+      return thread->TrySend(op.target, op.args[0], &op.args[1]);
+
+    case kBatchNotify:
+      thread->Notify(op.target, op.args[0], /*run_now=*/ false);
+      return 0;
+
+    case kBatchAckInterrupt:
+      // FIXME: Same checks as SysAckInterrupt.
+      g_interrupts->Acknowledge(op.target);
+      return 0;
+
+    case kBatchUnmapShared:
+      return thread->address_space()->Unmap(op.args[0], op.args[0] + op.args[1]);
+
+    default:
+      return kBatchBadOpcode;
+  }
+}
+
+int ProcessBatch(Thread* thread, virt_addr_t ring_addr) {
+  // Go through the kernel's own mapping of the page, so a bad address fails
+  // here instead of faulting in the kernel.
+  phys_addr_t phys;
+  PageAttributes attrs;
+  if ((ring_addr & (kPageSize - 1)) ||
+      !thread->address_space()->Translate(ring_addr, &phys, &attrs) || !attrs.writable()) {
+    return -1;
+  }
+  BatchRing* ring = reinterpret_cast<BatchRing*>(PhysicalToVirtual(phys));
+
+  // Other threads of the task can write to the ring as we go. They can only
+  // confuse the task itself, as long as every slot index is masked and the
+  // loop is bounded.
+  uint32_t sq_head = ring->sq_head;
+  uint32_t sq_tail = __atomic_load_n(&ring->sq_tail, __ATOMIC_ACQUIRE);
+  uint32_t cq_tail = ring->cq_tail;
+  uint32_t cq_head = __atomic_load_n(&ring->cq_head, __ATOMIC_ACQUIRE);
+
+  int taken = 0;
+  while (sq_head != sq_tail && uint32_t(taken) < kBatchEntries) {
+    BatchSubmission op = ring->submissions[sq_head % kBatchEntries];
+    bool quiet = op.flags & kBatchQuiet;
+    if (!quiet && cq_tail - cq_head >= kBatchEntries) break;
+
+    int64_t result = RunSubmission(thread, op);
+    sq_head++;
+    taken++;
+
+    if (!quiet) {
+      BatchCompletion& completion = ring->completions[cq_tail % kBatchEntries];
+      completion.user_data = op.user_data;
+      completion.result = result;
+      cq_tail++;
+    }
+  }
+
+  __atomic_store_n(&ring->cq_tail, cq_tail, __ATOMIC_RELEASE);
+  __atomic_store_n(&ring->sq_head, sq_head, __ATOMIC_RELEASE);
+  return taken;
+}
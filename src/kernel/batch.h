@@ -0,0 +1,61 @@
+#ifndef batch_h
+#define batch_h
+
+#include "base/types.h"
+#include "kernel/thread.h"
+
+// System calls submitted in batches through a page shared with the kernel,
+// so a chatty task enters the kernel once for several calls. Warning: Any
+// changes to these structures must be reflected in usr/batch.h.
+//
+// The task fills in submissions at sq_tail and advances it. SysSubmitBatch
+// runs them from sq_head in order and posts a completion for each at cq_tail,
+// unless the submission has kBatchQuiet set. The task takes completions from
+// cq_head. The indices count up forever; slots are at index % kBatchEntries.
+static const uint32_t kBatchEntries = 32;
+
+enum BatchOpcode {
+  kBatchSend = 1,          // target: tid, args: tag, then the words.
+  kBatchNotify = 2,        // target: tid, args[0]: bits.
+  kBatchAckInterrupt = 3,  // target: irq.
+  kBatchUnmapShared = 4,   // args[0]: address, args[1]: size.
+};
+
+// Don't post a completion.
+static const uint16_t kBatchQuiet = 1;
+
+struct BatchSubmission {
+  uint16_t opcode;
+  uint16_t flags;
+  int32_t target;
+  uint64_t user_data;
+  uint64_t args[1 + kMaxMessageWords];
+};
+
+struct BatchCompletion {
+  uint64_t user_data;
+  int64_t result;
+};
+
+struct BatchRing {
+  uint32_t sq_head;
+  uint32_t sq_tail;
+  uint32_t cq_head;
+  uint32_t cq_tail;
+  BatchSubmission submissions[kBatchEntries];
+  BatchCompletion completions[kBatchEntries];
+};
+
+static_assert(sizeof(BatchRing) <= kPageSize, "The batch ring must fit in a page");
+
+// What an unknown opcode completes with.
+static const int kBatchBadOpcode = -3;
+
+// Runs what |thread| queued in the ring at |ring|, a page in its address
+// space. None of the calls block or switch threads: sends that would have to
+// wait complete with kWouldBlock, and threads they wake up go on run queues.
+// Stops early if the completion queue fills up. Returns the number of
+// submissions taken, or -1 if |ring| isn't a writable page.
+int ProcessBatch(Thread* thread, virt_addr_t ring);
+
+#endif
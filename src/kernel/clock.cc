@@ -0,0 +1,38 @@
+#include "clock.h"
+
+#include "base/assertions.h"
+#include "kernel/msr.h"
+#include "kernel/serial.h"
+#include "kernel/timer.h"
+
+Clock* g_clock;
+
+void Clock::Calibrate(IoPorts* io) {
+  const int kCalibrationMs = 10;
+
+  uint64_t start = ReadTsc();
+  PitTimer::BusyWait(io, kCalibrationMs * 1000);
+  uint64_t end = ReadTsc();
+
+  tsc_per_ms_ = (end - start) / kCalibrationMs;
+  assert_gt(tsc_per_ms_, 0);
+  ns_per_tsc_ = (uint64_t(1000000) << 32) / tsc_per_ms_;
+  start_tsc_ = end;
+
+  LOG(INFO).Printf("TSC: %u kHz", unsigned(tsc_per_ms_));
+}
+
+uint64_t Clock::Now() const {
+  uint64_t elapsed = ReadTsc() - start_tsc_;
+
+  // Only a multiplication, so no 128-bit division helper is needed.
+  return uint64_t((static_cast<unsigned __int128>(elapsed) * ns_per_tsc_) >> 32);
+}
+
+uint64_t Clock::Deadline(uint64_t ns) const {
+  uint64_t now = Now();
+  if (ns >= UINT64_MAX - 1 - now) {
+    return UINT64_MAX - 1;
+  }
+  return now + ns;
+}
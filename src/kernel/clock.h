@@ -0,0 +1,35 @@
+#ifndef clock_h
+#define clock_h
+
+#include "base/io.h"
+#include "base/types.h"
+
+// Time since boot, from the time stamp counter. Assumes the TSC runs at a
+// constant rate and is in sync on all CPUs, which holds for QEMU and anything
+// with an invariant TSC.
+class Clock {
+public:
+  // Measures the TSC frequency against PIT channel 2.
+  void Calibrate(IoPorts* io);
+
+  // Nanoseconds since Calibrate.
+  uint64_t Now() const;
+
+  // Now() + |ns|, as a deadline for Scheduler::AddTimeout. Stops short of
+  // UINT64_MAX instead of wrapping around, so a huge timeout means a very
+  // late deadline rather than one that passed already.
+  uint64_t Deadline(uint64_t ns) const;
+
+  uint64_t tsc_per_ms() const { return tsc_per_ms_; }
+
+private:
+  uint64_t start_tsc_ = 0;
+  uint64_t tsc_per_ms_ = 0;
+
+  // Nanoseconds per TSC tick, as a 32.32 fixed point number.
+  uint64_t ns_per_tsc_ = 0;
+};
+
+extern Clock* g_clock;
+
+#endif  // clock_h
@@ -0,0 +1,55 @@
+#include "cpu.h"
+
+#include "kernel/fpu.h"
+#include "kernel/frame_allocator.h"
+#include "kernel/msr.h"
+#include "kernel/page_translation.h"
+#include "kernel/spinlock.h"
+#include "kernel/thread.h"
+
+SpinLock g_kernel_lock;
+
+static CpuState cpu_states[kMaxCpus];
+
+extern "C" void syscall_entry();
+
+Cpu::Cpu(int index, VMEnv* env)
+  : self_(this),
+    index_(index),
+    vm_(env) {}
+
+void Cpu::Init() {
+  // The initial APIC ID, readable before the local APIC is mapped.
+  apic_id_ = Cpuid(1).ebx >> 24;
+
+  cpu_state_ = &cpu_states[index_];
+
+  vm_.Load();
+  InitFpu();
+
+  // The entry paths swap in the kernel GS base with swapgs when they come
+  // from user space, and swap it back out on the way back.
+  WriteMsr(kGsBaseMsr, reinterpret_cast<uint64_t>(this));
+  WriteMsr(kKernelGsBaseMsr, 0);
+
+  // The syscall instruction loads cs from STAR[47:32] and ss from the next
+  // descriptor. sysret loads ss from STAR[63:48] + 8 and cs from the one after
+  // that, which is why the user stack segment comes first in the GDT.
+  static_assert(kKernelStackSegmentIndex == kKernelCodeSegmentIndex + 1, "GDT order");
+  static_assert(kUserStackSegmentIndex == kKernelStackSegmentIndex + 1, "GDT order");
+  static_assert(kUserCodeSegmentIndex == kUserStackSegmentIndex + 1, "GDT order");
+  uint64_t syscall_cs = SegmentSelector(kKernelCodeSegmentIndex).Serialize();
+  uint64_t sysret_base = SegmentSelector(kKernelStackSegmentIndex, kUserPrivilege).Serialize();
+  WriteMsr(kStarMsr, (sysret_base << 48) | (syscall_cs << 32));
+  WriteMsr(kLStarMsr, reinterpret_cast<uint64_t>(&syscall_entry));
+
+  // Entered with interrupts off, like the interrupt gates.
+  WriteMsr(kSfMaskMsr, kRflagsInterrupt | kRflagsTrap | kRflagsDirection |
+                       kRflagsNestedTask | kRflagsAlignmentCheck);
+  WriteMsr(kEferMsr, ReadMsr(kEferMsr) | kEferSyscallEnable);
+}
+
+void Cpu::SetKernelStack(virt_addr_t stack_top) {
+  kernel_stack_ = stack_top;
+  vm_.SetKernelStack(stack_top);
+}
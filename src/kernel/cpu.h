@@ -0,0 +1,65 @@
+#ifndef cpu_h
+#define cpu_h
+
+#include "base/types.h"
+#include "kernel/protection.h"
+
+struct CpuState;
+
+const int kMaxCpus = 16;
+
+// Per-CPU state. While a CPU runs kernel code, its GS base points at its Cpu,
+// so CurrentCpu() is a single load.
+class Cpu {
+public:
+  Cpu(int index, VMEnv* env);
+
+  // Must run on the CPU this object describes. Loads its GDT, TSS and IDT,
+  // and points GS at this object.
+  void Init();
+
+  int index() const { return index_; }
+  uint32_t apic_id() const { return apic_id_; }
+  CpuState* cpu_state() const { return cpu_state_; }
+
+  // Sets the stack the CPU enters the kernel on from user space: the kernel
+  // stack of the thread about to run.
+  void SetKernelStack(virt_addr_t stack_top);
+
+  // Asks the CPU to flush its TLB. It does so while it waits for the kernel
+  // lock (interrupt_handlers.s:acquire_kernel_lock), and clears the request.
+  void RequestTlbFlush() { __atomic_store_n(&tlb_flush_pending_, 1, __ATOMIC_RELEASE); }
+  bool tlb_flush_pending() const { return __atomic_load_n(&tlb_flush_pending_, __ATOMIC_ACQUIRE); }
+
+private:
+  // Warning: The first five members are accessed through gs by
+  // interrupt_handlers.s:cpu. Keep the two in sync.
+
+  // Must be the first member! Read through gs:0.
+  Cpu* self_;
+
+  CpuState* cpu_state_ = nullptr;
+
+  // Where the syscall instruction entry path keeps the user stack pointer
+  // until it has switched stacks.
+  uint64_t user_rsp_ = 0;
+
+  // Where the syscall instruction entry path switches stacks to. The
+  // interrupt gates get the same from the TSS.
+  virt_addr_t kernel_stack_ = 0;
+
+  // Set by RequestTlbFlush.
+  uint64_t tlb_flush_pending_ = 0;
+
+  int index_;
+  uint32_t apic_id_ = 0;
+  VM vm_;
+};
+
+inline Cpu* CurrentCpu() {
+  Cpu* cpu;
+  asm volatile("mov %%gs:0, %0" : "=r"(cpu));
+  return cpu;
+}
+
+#endif  // cpu_h
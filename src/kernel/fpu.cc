@@ -0,0 +1,112 @@
+#include "fpu.h"
+
+#include "base/assertions.h"
+#include "kernel/msr.h"
+
+#include <string.h>
+
+Allocator<FpuState>* g_fpu_state_allocator;
+DEFINE_ALLOCATION_METHODS(FpuState, g_fpu_state_allocator);
+
+static const uint64_t kCr0MonitorCoprocessor = 1 << 1;
+static const uint64_t kCr0Emulation = 1 << 2;
+static const uint64_t kCr0TaskSwitched = 1 << 3;
+static const uint64_t kCr0NumericError = 1 << 5;
+
+static const uint64_t kCr4OsFxsr = 1 << 9;
+static const uint64_t kCr4OsXmmExceptions = 1 << 10;
+static const uint64_t kCr4OsXsave = 1 << 18;
+
+static const uint32_t kCpuidXsave = 1 << 26;
+static const uint32_t kCpuidAvx = 1 << 28;
+
+static const uint64_t kXcr0X87 = 1 << 0;
+static const uint64_t kXcr0Sse = 1 << 1;
+static const uint64_t kXcr0Avx = 1 << 2;
+
+// Where FXSAVE and XSAVE keep the x87 control word and MXCSR.
+static const size_t kFcwOffset = 0;
+static const size_t kMxcsrOffset = 24;
+
+// Everything masked, round to nearest.
+static const uint16_t kDefaultFcw = 0x37f;
+static const uint32_t kDefaultMxcsr = 0x1f80;
+
+// Same on every CPU.
+static bool use_xsave = false;
+
+static uint64_t ReadCr0() {
+  uint64_t value;
+  asm volatile("mov %%cr0, %0" : "=r"(value));
+  return value;
+}
+
+static void WriteCr0(uint64_t value) {
+  asm volatile("mov %0, %%cr0" : : "r"(value));
+}
+
+static uint64_t ReadCr4() {
+  uint64_t value;
+  asm volatile("mov %%cr4, %0" : "=r"(value));
+  return value;
+}
+
+static void WriteCr4(uint64_t value) {
+  asm volatile("mov %0, %%cr4" : : "r"(value));
+}
+
+void InitFpu() {
+  uint32_t features = Cpuid(1).ecx;
+  use_xsave = features & kCpuidXsave;
+
+  uint64_t cr4 = ReadCr4() | kCr4OsFxsr | kCr4OsXmmExceptions;
+  if (use_xsave) {
+    cr4 |= kCr4OsXsave;
+  }
+  WriteCr4(cr4);
+
+  if (use_xsave) {
+    uint64_t xcr0 = kXcr0X87 | kXcr0Sse;
+    if (features & kCpuidAvx) {
+      xcr0 |= kXcr0Avx;
+    }
+    asm volatile("xsetbv" : : "c"(0), "a"(uint32_t(xcr0)), "d"(uint32_t(xcr0 >> 32)));
+
+    // The size of the XSAVE area for what XCR0 turned on.
+    assert_le(Cpuid(0xd, 0).ebx, FpuState::kSize);
+  }
+
+  WriteCr0((ReadCr0() & ~kCr0Emulation) | kCr0MonitorCoprocessor | kCr0NumericError | kCr0TaskSwitched);
+}
+
+void ResetFpuState(FpuState* state) {
+  // An XSAVE header of zeros makes XRSTOR put every component in its initial
+  // state, except for MXCSR, which is always loaded. FXRSTOR loads all of it.
+  memset(state->data, 0, sizeof(state->data));
+  memcpy(state->data + kFcwOffset, &kDefaultFcw, sizeof(kDefaultFcw));
+  memcpy(state->data + kMxcsrOffset, &kDefaultMxcsr, sizeof(kDefaultMxcsr));
+}
+
+void SaveFpuState(FpuState* state) {
+  if (use_xsave) {
+    asm volatile("xsave64 %0" : "=m"(state->data) : "a"(~0u), "d"(~0u) : "memory");
+  } else {
+    asm volatile("fxsave64 %0" : "=m"(state->data) : : "memory");
+  }
+}
+
+void RestoreFpuState(const FpuState* state) {
+  if (use_xsave) {
+    asm volatile("xrstor64 %0" : : "m"(state->data), "a"(~0u), "d"(~0u) : "memory");
+  } else {
+    asm volatile("fxrstor64 %0" : : "m"(state->data) : "memory");
+  }
+}
+
+void EnableFpu() {
+  asm volatile("clts");
+}
+
+void DisableFpu() {
+  WriteCr0(ReadCr0() | kCr0TaskSwitched);
+}
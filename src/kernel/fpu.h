@@ -0,0 +1,44 @@
+#ifndef fpu_h
+#define fpu_h
+
+#include "base/types.h"
+#include "kernel/allocator.h"
+
+// The x87, SSE and, where the CPU has it, AVX registers of a thread while it
+// isn't using them. Only threads that ever touch the registers get one.
+//
+// Switching threads doesn't load any of this. It sets CR0.TS instead, so the
+// first instruction that uses the registers traps (#NM), and only then does
+// the scheduler bring in the state of the running thread. The kernel itself
+// never uses the registers.
+struct FpuState {
+  // Room for the x87, SSE and AVX state in the XSAVE layout.
+  static const size_t kSize = 1024;
+
+  uint8_t data[kSize] __attribute__((aligned(64)));
+
+  DECLARE_ALLOCATION_METHODS();
+};
+
+extern Allocator<FpuState>* g_fpu_state_allocator;
+
+// Turns on the registers on the calling CPU, using XSAVE if the CPU has it,
+// and leaves CR0.TS set.
+void InitFpu();
+
+// Sets the state a thread starts out with: all registers clear, all
+// exceptions masked.
+void ResetFpuState(FpuState* state);
+
+void SaveFpuState(FpuState* state);
+void RestoreFpuState(const FpuState* state);
+
+// Clears and sets CR0.TS.
+void EnableFpu();
+void DisableFpu();
+
+// The vector of the trap taken on the first use of the registers with CR0.TS
+// set.
+static const int kDeviceNotAvailableVector = 7;
+
+#endif
@@ -0,0 +1,79 @@
+#include "futex.h"
+
+#include "kernel/clock.h"
+#include "kernel/page_translation.h"
+#include "kernel/thread.h"
+
+FutexTable* g_futex_table;
+
+bool FutexTable::Key(Thread* thread, virt_addr_t addr, phys_addr_t* key) {
+  if (addr & (sizeof(uint32_t) - 1)) return false;
+  return thread->address_space()->Translate(addr, key);
+}
+
+LinkedList<Thread, 0>& FutexTable::Bucket(phys_addr_t key) {
+  return buckets_[(key / sizeof(uint32_t)) % kNumBuckets];
+}
+
+void FutexTable::Wait(Thread* thread, virt_addr_t addr, uint32_t expected, uint64_t timeout_ns) {
+  phys_addr_t key;
+  if (!Key(thread, addr, &key)) {
+    thread->SetReturnValue(uint64_t(kFault));
+    return;
+  }
+
+  // Wakers come through the kernel lock too, so nobody can change the word
+  // and call Wake between this check and our going to sleep.
+  uint32_t value = __atomic_load_n(reinterpret_cast<uint32_t*>(PhysicalToVirtual(key)), __ATOMIC_SEQ_CST);
+  if (value != expected) {
+    thread->SetReturnValue(uint64_t(Thread::kWouldBlock));
+    return;
+  }
+  if (timeout_ns == 0) {
+    thread->SetReturnValue(uint64_t(Thread::kTimedOut));
+    return;
+  }
+  if (timeout_ns != Thread::kNoTimeout &&
+      !g_scheduler->AddTimeout(thread, g_clock->Deadline(timeout_ns))) {
+    thread->SetReturnValue(uint64_t(Thread::kTooManyTimeouts));
+    return;
+  }
+
+  // Behind the waiters of the same or a more urgent priority, like senders.
+  LinkedList<Thread, 0>& bucket = Bucket(key);
+  bool queued = false;
+  for (auto it = bucket.rbegin(); it; ++it) {
+    if (it->priority_ <= thread->priority_) {
+      it->thread_links.InsertAfter(thread->thread_links);
+      queued = true;
+      break;
+    }
+  }
+  if (!queued) {
+    bucket.PushFront(thread->thread_links);
+  }
+
+  thread->SetReturnValue(0);
+  thread->futex_key_ = key;
+  thread->status_ = Thread::kBlockedFutex;
+  g_scheduler->Reschedule(false);
+}
+
+int FutexTable::Wake(Thread* thread, virt_addr_t addr, int count) {
+  phys_addr_t key;
+  if (!Key(thread, addr, &key)) return kFault;
+
+  LinkedList<Thread, 0>& bucket = Bucket(key);
+  int woken = 0;
+  for (auto it = bucket.begin(); it && woken < count;) {
+    Thread* waiter = &*it;
+    ++it;
+    if (waiter->futex_key_ != key) continue;
+
+    waiter->thread_links.Remove();
+    waiter->Wake();
+    woken++;
+  }
+
+  return woken;
+}
@@ -0,0 +1,44 @@
+#ifndef futex_h
+#define futex_h
+
+#include "base/linked_list.h"
+#include "base/types.h"
+
+class Thread;
+
+// Wait queues for user-level locks. A task keeps its lock word in its own
+// memory and only enters the kernel when it has to wait for the word to
+// change, or to wake up threads waiting for that.
+//
+// Waiters are keyed by the physical address the word maps to, so threads in
+// different address spaces meet on a word in pages shared between them.
+class FutexTable {
+public:
+  // Blocks |thread| until Wake is called on |addr|, if the 32-bit word there
+  // still holds |expected|. Returns, in the thread's rax, 0 once woken up,
+  // Thread::kWouldBlock if the word held something else, Thread::kTimedOut
+  // if |timeout_ns| passed first, Thread::kTooManyTimeouts if the CPU can't
+  // take another timeout, or kFault if |addr| isn't a mapped, aligned user
+  // address.
+  void Wait(Thread* thread, virt_addr_t addr, uint32_t expected, uint64_t timeout_ns);
+
+  // Wakes up to |count| threads waiting on |addr| in the address space of
+  // |thread|, most urgent first. Returns the number woken up, or kFault.
+  int Wake(Thread* thread, virt_addr_t addr, int count);
+
+  static const int kFault = -3;
+
+private:
+  // Looks up the key of the word at |addr|. Returns false if there is no
+  // word there the thread can use.
+  static bool Key(Thread* thread, virt_addr_t addr, phys_addr_t* key);
+
+  LinkedList<Thread, 0>& Bucket(phys_addr_t key);
+
+  static const int kNumBuckets = 256;
+  LinkedList<Thread, 0> buckets_[kNumBuckets];
+};
+
+extern FutexTable* g_futex_table;
+
+#endif
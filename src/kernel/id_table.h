@@ -0,0 +1,155 @@
+#ifndef id_table_h
+#define id_table_h
+
+#include "base/assertions.h"
+#include "base/types.h"
+#include "kernel/frame_allocator.h"
+#include "kernel/page_translation.h"
+
+// Hands out IDs for objects and maps them back in constant time.
+//
+// An ID is a slot index in the low bits and the generation of the slot in
+// the bits above. Removing an object bumps the generation, so its ID stops
+// finding anything even once the slot is reused. Free slots are reused
+// oldest first, which makes it take as long as possible for an old ID to
+// come back.
+//
+// The slots live in pages taken from the frame allocator as the table grows.
+// Only the page directory is part of the table itself.
+//
+// IDs from 1 to kNumFixed - 1 are never handed out by Add. They are for
+// objects that need an ID known in advance, and have generation 0.
+template<typename T>
+class IdTable {
+public:
+  static const int kIndexBits = 16;
+  static const int kMaxSlots = 1 << kIndexBits;
+  static const int kNumFixed = 32;
+
+  // Returns the new ID of |object|, or 0 if the table is full.
+  int Add(T* object) {
+    if (free_head_ < 0 && !Grow()) return 0;
+
+    int index = free_head_;
+    Slot& slot = At(index);
+    free_head_ = slot.next_free;
+    if (free_head_ < 0) free_tail_ = -1;
+
+    slot.object = object;
+    slot.next_free = -1;
+    return MakeId(index, slot.generation);
+  }
+
+  // Puts |object| under a fixed ID. Returns false if |id| isn't one, or if
+  // it is taken.
+  bool AddFixed(int id, T* object) {
+    if (id <= 0 || id >= kNumFixed) return false;
+    if (!pages_[0] && !Grow()) return false;
+
+    Slot& slot = At(id);
+    if (slot.object) return false;
+    slot.object = object;
+    return true;
+  }
+
+  // Returns nullptr for IDs that were never handed out or whose object was
+  // removed.
+  T* Find(int id) const {
+    if (id <= 0) return nullptr;
+    int index = id & (kMaxSlots - 1);
+    uint32_t generation = uint32_t(id) >> kIndexBits;
+    Slot* page = pages_[index / kSlotsPerPage];
+    if (!page) return nullptr;
+
+    const Slot& slot = page[index % kSlotsPerPage];
+    if (slot.generation != generation) return nullptr;
+    return slot.object;
+  }
+
+  void Remove(int id) {
+    assert(Find(id));
+    int index = id & (kMaxSlots - 1);
+    Slot& slot = At(index);
+    slot.object = nullptr;
+    if (index < kNumFixed) return;
+
+    // Skip generation 0, which only fixed IDs have, when wrapping around.
+    slot.generation++;
+    if (slot.generation > kMaxGeneration) {
+      slot.generation = 1;
+    }
+    PushFree(index);
+  }
+
+  // Calls visit(object) for every object in the table, in slot order.
+  template<typename Visitor>
+  void ForEach(Visitor visit) const {
+    for (int i = 0; i < num_pages_; i++) {
+      for (int j = 0; j < kSlotsPerPage; j++) {
+        if (pages_[i][j].object) {
+          visit(pages_[i][j].object);
+        }
+      }
+    }
+  }
+
+private:
+  struct Slot {
+    T* object;
+    uint32_t generation;
+    int32_t next_free;
+  };
+
+  static const int kSlotsPerPage = kPageSize / sizeof(Slot);
+  static const int kNumPages = kMaxSlots / kSlotsPerPage;
+
+  // IDs have to stay positive.
+  static const uint32_t kMaxGeneration = (1u << (31 - kIndexBits)) - 1;
+
+  static int MakeId(int index, uint32_t generation) {
+    return int(generation << kIndexBits) | index;
+  }
+
+  Slot& At(int index) const {
+    return pages_[index / kSlotsPerPage][index % kSlotsPerPage];
+  }
+
+  void PushFree(int index) {
+    At(index).next_free = -1;
+    if (free_tail_ >= 0) {
+      At(free_tail_).next_free = index;
+    } else {
+      free_head_ = index;
+    }
+    free_tail_ = index;
+  }
+
+  // Adds a page of free slots. Returns false once there is no room for more.
+  bool Grow() {
+    if (num_pages_ == kNumPages) return false;
+
+    int page_index = num_pages_++;
+    Slot* page = reinterpret_cast<Slot*>(PhysicalToVirtual(g_frame_allocator->AllocateFrame()));
+    pages_[page_index] = page;
+
+    int first = page_index * kSlotsPerPage;
+    for (int i = 0; i < kSlotsPerPage; i++) {
+      page[i] = Slot{nullptr, 0, -1};
+      int index = first + i;
+      if (index < kNumFixed) continue;
+      page[i].generation = 1;
+      PushFree(index);
+    }
+    return true;
+  }
+
+  Slot* pages_[kNumPages] = {};
+  int num_pages_ = 0;
+  int free_head_ = -1;
+  int free_tail_ = -1;
+};
+
+template<typename T> const int IdTable<T>::kMaxSlots;
+template<typename T> const int IdTable<T>::kNumFixed;
+
+#endif
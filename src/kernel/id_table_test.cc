@@ -0,0 +1,98 @@
+#include "id_table.h"
+#include "page_translation.h"
+
+#include "gtest/gtest.h"
+
+#include <set>
+#include <sys/mman.h>
+
+uintptr_t g_kernel_virtual_start = 0;
+intptr_t g_kernel_virtual_offset = (1 << 21);
+
+struct TestObject {
+  int value = 0;
+};
+
+typedef IdTable<TestObject> TestTable;
+
+TEST(IdTableTest, AddFindRemove) {
+  TestTable table;
+  TestObject a, b;
+  int id_a = table.Add(&a);
+  int id_b = table.Add(&b);
+  EXPECT_GE(id_a, TestTable::kNumFixed);
+  EXPECT_GE(id_b, TestTable::kNumFixed);
+  EXPECT_NE(id_a, id_b);
+
+  EXPECT_EQ(table.Find(id_a), &a);
+  EXPECT_EQ(table.Find(id_b), &b);
+  EXPECT_EQ(table.Find(0), nullptr);
+  EXPECT_EQ(table.Find(-1), nullptr);
+  EXPECT_EQ(table.Find(id_a + 100), nullptr);
+
+  table.Remove(id_a);
+  EXPECT_EQ(table.Find(id_a), nullptr);
+  EXPECT_EQ(table.Find(id_b), &b);
+}
+
+TEST(IdTableTest, StaleIdsFindNothing) {
+  TestTable table;
+  TestObject a;
+  int first = table.Add(&a);
+  table.Remove(first);
+
+  // Keep reusing slots until the first one comes back with a new generation.
+  std::set<int> seen;
+  for (int i = 0; i < TestTable::kMaxSlots; i++) {
+    int id = table.Add(&a);
+    ASSERT_GT(id, 0);
+    EXPECT_TRUE(seen.insert(id).second);
+    EXPECT_EQ(table.Find(first), nullptr);
+    table.Remove(id);
+  }
+}
+
+TEST(IdTableTest, FixedIds) {
+  TestTable table;
+  TestObject a, b;
+  EXPECT_TRUE(table.AddFixed(5, &a));
+  EXPECT_FALSE(table.AddFixed(5, &b));
+  EXPECT_FALSE(table.AddFixed(0, &b));
+  EXPECT_FALSE(table.AddFixed(TestTable::kNumFixed, &b));
+  EXPECT_EQ(table.Find(5), &a);
+
+  table.Remove(5);
+  EXPECT_EQ(table.Find(5), nullptr);
+  EXPECT_TRUE(table.AddFixed(5, &b));
+  EXPECT_EQ(table.Find(5), &b);
+}
+
+TEST(IdTableTest, Full) {
+  TestTable table;
+  TestObject a;
+  int count = 0;
+  while (table.Add(&a)) {
+    count++;
+  }
+  EXPECT_EQ(count, TestTable::kMaxSlots - TestTable::kNumFixed);
+}
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+
+  // Room for the slot pages of a few full tables.
+  const size_t kRegionSize = 4 << 20;
+  void* region = mmap(nullptr, kRegionSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  assert_ne(region, MAP_FAILED);
+
+  virt_addr_t virt = reinterpret_cast<virt_addr_t>(region);
+  g_kernel_virtual_start = virt;
+
+  phys_addr_t phys = VirtualToPhysical(virt);
+
+  FrameAllocator frame_alloc(0, 0, 0, 0);
+  frame_alloc.AddRegion(phys, phys + kRegionSize);
+  g_frame_allocator = &frame_alloc;
+
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,35 @@
+#include "image_cache.h"
+
+#include <string.h>
+
+// 64-bit FNV-1a.
+uint64_t ImageCache::Hash(const char* data, size_t size) {
+  uint64_t hash = 0xcbf29ce484222325;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= uint8_t(data[i]);
+    hash *= 0x100000001b3;
+  }
+  return hash;
+}
+
+const char* ImageCache::Find(const char* data, size_t size) const {
+  uint64_t hash = Hash(data, size);
+  for (int i = 0; i < num_entries_; i++) {
+    const Entry& entry = entries_[i];
+    if (entry.hash != hash || entry.size != size) continue;
+
+    // Don't trust the hash alone.
+    if (memcmp(entry.data, data, size) == 0) {
+      return entry.data;
+    }
+  }
+
+  return nullptr;
+}
+
+void ImageCache::Add(const char* data, size_t size) {
+  // The cache is only an optimization, so just stop remembering images once it's full.
+  if (num_entries_ == kMaxEntries) return;
+
+  entries_[num_entries_++] = Entry{Hash(data, size), data, size};
+}
@@ -0,0 +1,32 @@
+#ifndef image_cache_h
+#define image_cache_h
+
+#include "base/types.h"
+
+// Remembers the multiboot modules that have already been loaded, keyed by a
+// hash of their contents. If the same ELF is listed more than once in
+// grub.cfg, later copies can map their read-only segments from the frames of
+// the first copy instead of their own.
+class ImageCache {
+public:
+  // Returns the start of a previously added image with exactly the same
+  // contents as [data, data + size), or nullptr if there is none.
+  const char* Find(const char* data, size_t size) const;
+
+  void Add(const char* data, size_t size);
+
+private:
+  static uint64_t Hash(const char* data, size_t size);
+
+  struct Entry {
+    uint64_t hash;
+    const char* data;
+    size_t size;
+  };
+
+  static const int kMaxEntries = 32;
+  Entry entries_[kMaxEntries] = {};
+  int num_entries_ = 0;
+};
+
+#endif  // image_cache_h
@@ -1,9 +1,16 @@
 extern kinterrupt
 extern syscall_handler_table
+extern g_kernel_lock
+extern SwitchKernelStacks
+extern FinishKernelSwitch
+extern TraceSyscall
 
 global interrupt_handler_table
 global syscall_handler
-global SchedulerStart
+global syscall_entry
+global thread_start
+global SwitchKernelContext
+global ResumeKernelContext
 global SwitchAddressSpace
 
 ; Warning: Any changes to this structure must be reflected in thread.h:ThreadState.
@@ -35,6 +42,22 @@ cpu_current_thread: resb 8
 cpu_previous_thread: resb 8
 endstruc
 
+; Warning: Any changes to this structure must be reflected in cpu.h:Cpu.
+struc cpu
+cpu_self: resb 8
+cpu_cpu_state: resb 8
+cpu_user_rsp: resb 8
+cpu_kernel_stack: resb 8
+cpu_tlb_flush_pending: resb 8
+endstruc
+
+; Vectors below this are CPU exceptions (interrupts.cc).
+FIRST_IRQ_VECTOR equ 32
+
+; The user selectors from protection.h, with RPL 3.
+USER_STACK_SELECTOR equ (3 << 3) | 3
+USER_CODE_SELECTOR equ (4 << 3) | 3
+
 %macro handler_no_error 1
 global int%1_handler
 int%1_handler:
@@ -50,30 +73,93 @@ int%1_handler:
   jmp common_interrupt_handler
 %endmacro
 
-; This code is called at boot time to start scheduling.
-; On function entry, rdi contains the ThreadState for the thread to start.
-; We restore rdi from the ThreadState so we can pass an argument to
-; thread startup.
-SchedulerStart:
-  push qword[rdi + ts_ss]
-  push qword[rdi + ts_rsp]
-  push qword[rdi + ts_rflags]
-  push qword[rdi + ts_cs]
-  push qword[rdi + ts_rip]
-  mov rdi, qword[rdi + ts_rdi]
+; Only one CPU runs kernel code at a time. Every entry path takes the kernel
+; lock (spinlock.h) and every exit path drops it. Clobbers the flags only.
+;
+; A CPU that asks for a TLB shootdown holds the lock until the others flushed
+; (Scheduler::ShootDownTlb), so they do that while they spin.
+%macro acquire_kernel_lock 0
+%%retry:
+  lock bts qword[rel g_kernel_lock], 0
+  jnc %%done
+%%spin:
+  pause
+  cmp qword[gs:cpu_tlb_flush_pending], 0
+  jne %%flush
+  test qword[rel g_kernel_lock], 1
+  jnz %%spin
+  jmp %%retry
+%%flush:
+  push rax
+  mov rax, cr3
+  mov cr3, rax
+  pop rax
+  mov qword[gs:cpu_tlb_flush_pending], 0
+  jmp %%spin
+%%done:
+%endmacro
+
+%macro release_kernel_lock 0
+  mov qword[rel g_kernel_lock], 0
+%endmacro
+
+; While in the kernel, the GS base points at the Cpu of the current CPU
+; (cpu.h). User space gets its own GS base, so swap on every privilege change.
+; The argument is the offset of the saved cs from rsp.
+%macro swapgs_if_user 1
+  test qword[rsp + %1], 3
+  jz %%kernel
+  swapgs
+%%kernel:
+%endmacro
+
+; Leaves the kernel through the interrupt frame on the stack.
+%macro return_from_kernel 0
+  release_kernel_lock
+  swapgs_if_user 8
   iretq
+%endmacro
 
 SwitchAddressSpace:
   mov cr3, rdi
   ret
 
-%macro restore_thread_regs 0
-  ; Layout of the stack at this time:
-  ; INTERRUPT_STACK_HIGH:
-  ;   CpuState::previous_thread [rsp + 8]
-  ;   CpuState::current_thread [rsp + 0]
+; Every thread has its own kernel stack (thread.h). A thread that stops
+; running in the kernel keeps its place there, with the callee-saved registers
+; pushed on top, and picks up from it the next time it is switched to.
+
+; void SwitchKernelContext(uint64_t* save_rsp, uint64_t load_rsp)
+SwitchKernelContext:
+  push rbx
+  push rbp
+  push r12
+  push r13
+  push r14
+  push r15
+  mov qword[rdi], rsp
+  mov rdi, rsi
+  ; Fall through.
+
+; void ResumeKernelContext(uint64_t load_rsp)
+; Like SwitchKernelContext, for when there is nothing to come back to.
+ResumeKernelContext:
+  mov rsp, rdi
+  pop r15
+  pop r14
+  pop r13
+  pop r12
+  pop rbp
+  pop rbx
+  ret
 
-  mov rax, qword[rsp]           ; Copy CpuState::current_thread to rax
+; Loads the ThreadState of the running thread into %1.
+%macro current_thread_state 1
+  mov %1, qword[gs:cpu_cpu_state]
+  mov %1, qword[%1 + cpu_current_thread]
+%endmacro
+
+%macro restore_thread_regs 0
+  current_thread_state rax
   mov rbx, qword[rax + ts_rbx]
   mov rcx, qword[rax + ts_rcx]
   mov rdx, qword[rax + ts_rdx]
@@ -99,6 +185,29 @@ SwitchAddressSpace:
   ; restoring the state.
 %endmacro
 
+; Where a new thread's kernel stack first returns to (Thread::Thread). It
+; leaves the kernel straight away, with the state the thread was created with.
+thread_start:
+  call FinishKernelSwitch
+  restore_thread_regs
+  return_from_kernel
+
+; Records the system call in the trace (trace.h). %1 holds the ThreadState
+; of the caller and must be callee-saved. The call clobbers the argument
+; registers, so they come back from there.
+%macro trace_syscall 1
+  mov rdi, qword[%1 + ts_rax]
+  call TraceSyscall
+  mov rax, qword[%1 + ts_rax]
+  mov rdi, qword[%1 + ts_rdi]
+  mov rsi, qword[%1 + ts_rsi]
+  mov rdx, qword[%1 + ts_rdx]
+  mov rcx, qword[%1 + ts_rcx]
+  mov r10, qword[%1 + ts_r10]
+  mov r8, qword[%1 + ts_r8]
+  mov r9, qword[%1 + ts_r9]
+%endmacro
+
 syscall_handler:
   ; AMD64 ABI:
   ; rbx, rbp, and r12-r15 are callee-saved registers.
@@ -107,49 +216,156 @@ syscall_handler:
   ; rax is the return value.
 
   ; Layout of the stack at this time:
-  ; INTERRUPT_STACK_HIGH: (the top of the page allocated for interrupts)
-  ;   CpuState::previous_thread [rsp + 48]
-  ;   CpuState::current_thread [rsp + 40]
+  ; KERNEL_STACK_HIGH: (the top of the running thread's kernel stack)
   ;   ss [rsp + 32]
   ;   rsp [rsp + 24]
   ;   rflags [rsp + 16]
   ;   cs [rsp + 8]
   ;   rip [rsp + 0]
 
-  mov r10, qword[rsp + 40]      ; Store CpuState::current_thread in r10
-  pop qword[r10 + ts_rip]
-  pop qword[r10 + ts_cs]
-  pop qword[r10 + ts_rflags]
-  pop qword[r10 + ts_rsp]
-  pop qword[r10 + ts_ss]
-
-  ; Callee-saved, so we need to save them.
-  mov qword[r10 + ts_rbx], rbx
-  mov qword[r10 + ts_r12], r12
-  mov qword[r10 + ts_r13], r13
-  mov qword[r10 + ts_r14], r14
-  mov qword[r10 + ts_r15], r15
-  mov qword[r10 + ts_rbp], rbp
+  swapgs_if_user 8
+  acquire_kernel_lock
+
+  ; Push rax so we have a free register to work with. Every register may
+  ; carry part of a message (thread.h), so all of them are saved.
+  push rax
+
+  current_thread_state rax
+  pop qword[rax + ts_rax]
+  pop qword[rax + ts_rip]
+  pop qword[rax + ts_cs]
+  pop qword[rax + ts_rflags]
+  pop qword[rax + ts_rsp]
+  pop qword[rax + ts_ss]
+  mov qword[rax + ts_rbx], rbx
+  mov qword[rax + ts_rcx], rcx
+  mov qword[rax + ts_rdx], rdx
+  mov qword[rax + ts_rsi], rsi
+  mov qword[rax + ts_rdi], rdi
+  mov qword[rax + ts_r8], r8
+  mov qword[rax + ts_r9], r9
+  mov qword[rax + ts_r10], r10
+  mov qword[rax + ts_r11], r11
+  mov qword[rax + ts_r12], r12
+  mov qword[rax + ts_r13], r13
+  mov qword[rax + ts_r14], r14
+  mov qword[rax + ts_r15], r15
+  mov qword[rax + ts_rbp], rbp
 
+  ; rbx is saved already, and restored on the way out.
+  mov rbx, rax
+  trace_syscall rbx             ; Leaves the syscall number in rax.
   mov r10, syscall_handler_table
   mov r11, qword[r10 + rax * 8]
   call r11
 
+  ; If the system call picked another thread to run, this one waits here
+  ; until it is switched back to.
+  call SwitchKernelStacks
+
   restore_thread_regs
 
-  iretq
+  return_from_kernel
+
+; Entry point of the syscall instruction (LSTAR). Same calling convention as
+; syscall_handler, except that the fourth argument comes in r10, because
+; syscall puts the user rip in rcx and rflags in r11. It leaves rsp alone and
+; disables interrupts (SFMASK).
+syscall_entry:
+  swapgs
+  mov qword[gs:cpu_user_rsp], rsp
+  mov rsp, qword[gs:cpu_kernel_stack]
+  acquire_kernel_lock
+
+  push r11
+  push rcx
+
+  ; Layout of the stack at this time:
+  ; KERNEL_STACK_HIGH:
+  ;   rflags [rsp + 8]
+  ;   rip [rsp + 0]
+
+  current_thread_state rcx
+  pop qword[rcx + ts_rip]
+  pop qword[rcx + ts_rflags]
+  mov r11, qword[gs:cpu_user_rsp]
+  mov qword[rcx + ts_rsp], r11
+  mov qword[rcx + ts_cs], USER_CODE_SELECTOR
+  mov qword[rcx + ts_ss], USER_STACK_SELECTOR
+
+  ; Every register but rcx and r11 may carry part of a message (thread.h).
+  mov qword[rcx + ts_rax], rax
+  mov qword[rcx + ts_rbx], rbx
+  mov qword[rcx + ts_rdx], rdx
+  mov qword[rcx + ts_rsi], rsi
+  mov qword[rcx + ts_rdi], rdi
+  mov qword[rcx + ts_r8], r8
+  mov qword[rcx + ts_r9], r9
+  mov qword[rcx + ts_r10], r10
+  mov qword[rcx + ts_r12], r12
+  mov qword[rcx + ts_r13], r13
+  mov qword[rcx + ts_r14], r14
+  mov qword[rcx + ts_r15], r15
+  mov qword[rcx + ts_rbp], rbp
+
+  ; Remember who called. rbx survives the call.
+  mov rbx, rcx
+  trace_syscall rbx
+
+  mov rcx, r10                  ; The fourth argument.
+  mov r10, syscall_handler_table
+  mov r11, qword[r10 + rax * 8]
+  call r11
+
+  ; If the system call picked another thread to run, this one waits here
+  ; until it is switched back to. Either way, it leaves the kernel as the
+  ; running thread, so sysret can take it back to where it came from.
+  call SwitchKernelStacks
+
+  ; Reload the registers a received message may have changed. This also
+  ; keeps kernel values from leaking through the caller-saved registers.
+  ; r14, r15 and rbp still hold the user values.
+  mov rax, qword[rbx + ts_rax]
+  mov rdx, qword[rbx + ts_rdx]
+  mov rsi, qword[rbx + ts_rsi]
+  mov rdi, qword[rbx + ts_rdi]
+  mov r8, qword[rbx + ts_r8]
+  mov r9, qword[rbx + ts_r9]
+  mov r10, qword[rbx + ts_r10]
+  mov r12, qword[rbx + ts_r12]
+  mov r13, qword[rbx + ts_r13]
+  mov rcx, qword[rbx + ts_rip]
+  mov r11, qword[rbx + ts_rflags]
+
+  release_kernel_lock
+  mov rsp, qword[rbx + ts_rsp]
+  mov rbx, qword[rbx + ts_rbx]
+  swapgs
+  o64 sysret
 
 common_interrupt_handler:
   ; Bochs debugging instruction.
   ;xchg bx, bx
 
+  swapgs_if_user 24
+
+  ; An exception in kernel code most likely comes with the kernel lock held
+  ; by this very CPU, and waiting for it would hang without a word. Those are
+  ; all fatal (kinterrupt), so go ahead without it: nothing gets released.
+  test qword[rsp + 24], 3
+  jnz .lock
+  cmp qword[rsp], FIRST_IRQ_VECTOR
+  jb .locked
+.lock:
+  acquire_kernel_lock
+.locked:
+
   ; Push rax so we have a free register to work with.
   push rax
 
   ; Layout of the stack at this time:
-  ; INTERRUPT_STACK_HIGH: (the top of the page allocated for interrupts)
-  ;   CpuState::previous_thread [rsp + 72]
-  ;   CpuState::current_thread [rsp + 64]
+  ; KERNEL_STACK_HIGH: (the top of the running thread's kernel stack, or
+  ; wherever the idle thread was, since it runs in kernel mode)
   ;   ss [rsp + 56]
   ;   rsp [rsp + 48]
   ;   rflags [rsp + 40]
@@ -159,7 +375,7 @@ common_interrupt_handler:
   ;   interrupt_number [rsp + 8]
   ;   saved rax [rsp + 0]
 
-  mov rax, qword[rsp + 64]      ; Store CpuState::current_thread in rax
+  current_thread_state rax
   pop qword[rax + ts_rax]       ; Copy the saved rax value to the ThreadState
   mov qword[rax + ts_rdi], rdi  ; Save rdi and rsi to the ThreadState. These will be used for kinterrupt parameters.
   mov qword[rax + ts_rsi], rsi
@@ -187,11 +403,13 @@ common_interrupt_handler:
   call kinterrupt
   ; kinterrupt returns nothing in rax.
 
+  call SwitchKernelStacks
+
   restore_thread_regs
 
   ;xchg bx, bx
 
-  iretq
+  return_from_kernel
 
 handler_no_error 0
 handler_no_error 1
@@ -232,6 +450,12 @@ handler_no_error 45
 handler_no_error 46
 handler_no_error 47
 
+handler_no_error 48
+handler_no_error 49
+handler_no_error 50
+
+handler_no_error 255
+
 align 8
 interrupt_handler_table:
   dq int0_handler
@@ -290,6 +514,8 @@ interrupt_handler_table:
   dd 37
   dq int38_handler
   dd 38
+  dq int39_handler
+  dd 39
   dq int40_handler
   dd 40
   dq int41_handler
@@ -306,5 +532,13 @@ interrupt_handler_table:
   dd 46
   dq int47_handler
   dd 47
+  dq int48_handler
+  dd 48
+  dq int49_handler
+  dd 49
+  dq int50_handler
+  dd 50
+  dq int255_handler
+  dd 255
   dq 0
   dd 0
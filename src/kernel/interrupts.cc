@@ -3,8 +3,12 @@
 #include "base/assertions.h"
 #include "base/io.h"
 #include "base/types.h"
+#include "kernel/apic.h"
+#include "kernel/fpu.h"
 #include "kernel/serial.h"
 #include "kernel/thread.h"
+#include "kernel/timer.h"
+#include "kernel/trace.h"
 
 static const int kPrimaryCommandPort = 0x20;
 static const int kPrimaryDataPort = 0x21;
@@ -14,11 +18,12 @@ static const int kSecondaryDataPort = 0xa1;
 
 static const int kEndOfInterruptCommand = 0x20;
 
-InterruptController* g_interrupts;
+// Vectors below this are CPU exceptions. Must match interrupt_handlers.s.
+static const int kFirstIrqVector = 32;
 
-extern "C" {
+InterruptController* g_interrupts;
 
-void kinterrupt(int64_t interrupt_number, uint64_t error_code) {
+static void HandleInterrupt(int64_t interrupt_number, uint64_t error_code) {
   // GPF
   if (interrupt_number == 13) {
     LOG(ERROR).Printf("GPF: error=%u", uint32_t(error_code));
@@ -37,12 +42,60 @@ void kinterrupt(int64_t interrupt_number, uint64_t error_code) {
     }
   }
 
+  if (interrupt_number == kDeviceNotAvailableVector) {
+    g_scheduler->HandleFpuTrap();
+    return;
+  }
+
+  // Any other exception. Returning would only fault again, and one raised
+  // in kernel code came in without the kernel lock, which returning would
+  // drop.
+  if (interrupt_number < kFirstIrqVector) {
+    LOG(ERROR).Printf("Exception %d: error=%u", int(interrupt_number), uint32_t(error_code));
+    g_scheduler->DumpState();
+    for (;;) {
+      asm("hlt");
+    }
+  }
+
+  if (g_timer && g_timer->HandleInterrupt(interrupt_number)) {
+    g_scheduler->TimerInterrupt();
+    return;
+  }
+
+  // The flush itself happened while we waited for the kernel lock.
+  if (interrupt_number == LocalApic::kTlbShootdownVector) {
+    g_local_apic->EndOfInterrupt();
+    return;
+  }
+
+  if (interrupt_number == LocalApic::kRescheduleVector) {
+    g_local_apic->EndOfInterrupt();
+    g_scheduler->CheckPreempt();
+    return;
+  }
+
+  // Spurious interrupts from the local APIC must not be acknowledged.
+  if (interrupt_number == LocalApic::kSpuriousVector) {
+    return;
+  }
+
   int irq = g_interrupts->InterruptNumberToIRQ(interrupt_number);
   if (irq >= 0) {
     g_interrupts->Interrupt(irq);
   }
 }
 
+extern "C" {
+
+void kinterrupt(int64_t interrupt_number, uint64_t error_code) {
+  Thread* thread = g_scheduler->current_thread();
+  int tid = thread ? thread->id() : 0;
+  Trace(kTraceIrqEnter, tid, interrupt_number);
+  HandleInterrupt(interrupt_number, error_code);
+  Trace(kTraceIrqExit, tid, interrupt_number);
+}
+
 }
 
 void InterruptController::Init() {
@@ -162,8 +215,9 @@ void InterruptController::Interrupt(int irq) {
 
   assert_lt(irq, kMaxIRQs);
   if (registrations_[irq]) {
+    // Each IRQ has its own notification bit.
     Thread* thread = registrations_[irq];
-    thread->NotifyFromKernel();
+    thread->NotifyFromKernel(uint64_t(1) << irq);
   } else {
     LOG(DEBUG).Printf("Acknowledging because no handler installed");
     Acknowledge(irq);
@@ -35,6 +35,7 @@ private:
 
   static const int kMaxIRQs = 32;
   Thread* registrations_[kMaxIRQs] = {};
+  static_assert(kMaxIRQs <= 64, "Each IRQ has a bit in the notification word");
 };
 
 extern InterruptController* g_interrupts;
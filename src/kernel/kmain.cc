@@ -3,8 +3,13 @@
 #include "base/placement_new.h"
 #include "base/types.h"
 #include "kernel/allocator.h"
+#include "kernel/apic.h"
+#include "kernel/clock.h"
+#include "kernel/cpu.h"
 #include "kernel/elf.h"
+#include "kernel/fpu.h"
 #include "kernel/frame_allocator.h"
+#include "kernel/futex.h"
 #include "kernel/interrupts.h"
 #include "kernel/loader.h"
 #include "kernel/multiboot.h"
@@ -12,7 +17,11 @@
 #include "kernel/page_translation.h"
 #include "kernel/protection.h"
 #include "kernel/serial.h"
+#include "kernel/smp.h"
+#include "kernel/spinlock.h"
 #include "kernel/thread.h"
+#include "kernel/timer.h"
+#include "kernel/work_queue.h"
 
 #include <string.h>
 
@@ -79,7 +88,14 @@ public:
 
   void MemoryMapEntry(uint64_t base_addr, uint64_t length, MemoryMapEntryType type) override {
     if (type != MemoryMapEntryType::kAvailableRAM) return;
-    frame_allocator_->AddRegion(base_addr, base_addr + length);
+
+    // Keep low memory for the AP startup trampoline.
+    const uint64_t kLowMemoryEnd = 0x100000;
+    uint64_t end_addr = base_addr + length;
+    if (end_addr <= kLowMemoryEnd) return;
+    if (base_addr < kLowMemoryEnd) base_addr = kLowMemoryEnd;
+
+    frame_allocator_->AddRegion(base_addr, end_addr);
   }
 
 private:
@@ -98,19 +114,33 @@ void IdleTask() {
 
 static LazyGlobal<SerialPort> serial_port;
 static LazyGlobal<FrameAllocator> frame_allocator;
-static LazyGlobal<VM> vm;
+static LazyGlobal<Cpu> cpus[kMaxCpus];
 static LazyGlobal<Scheduler> scheduler;
+static LazyGlobal<FutexTable> futex_table;
+static LazyGlobal<WorkQueue> work_queue;
 static LazyGlobal<InterruptController> interrupts;
+static LazyGlobal<Clock> tsc_clock;
+static LazyGlobal<LocalApic> local_apic;
+static LazyGlobal<PitTimer> pit_timer;
+static LazyGlobal<ApicTimer> apic_timer;
 
 static LazyGlobal<Allocator<AddressSpace>> address_space_allocator;
 static LazyGlobal<Allocator<Thread>> thread_allocator;
+static LazyGlobal<Allocator<FpuState>> fpu_state_allocator;
+
+// Holds the idle threads of all CPUs.
+static AddressSpace* idle_address_space;
 
 extern "C" {
 
 void kernel_physical_start();
 void kernel_physical_end();
+void SwitchAddressSpace(phys_addr_t tables);
 
 void kmain(const char* multiboot_info) {
+  // The other CPUs wait for this until we start scheduling.
+  g_kernel_lock.Lock();
+
   MultibootReader multiboot_reader(multiboot_info);
 
   IoPorts io;
@@ -137,15 +167,12 @@ void kmain(const char* multiboot_info) {
   g_address_space_allocator = &address_space_allocator.value();
   thread_allocator.emplace();
   g_thread_allocator = &thread_allocator.value();
-
-  phys_addr_t syscall_stack_phys = g_frame_allocator->AllocateFrame();
-  virt_addr_t syscall_stack_virt = PhysicalToVirtual(syscall_stack_phys);
-  virt_addr_t syscall_stack_top = syscall_stack_virt + kPageSize - Scheduler::SysCallStackAdjustment();
+  fpu_state_allocator.emplace();
+  g_fpu_state_allocator = &fpu_state_allocator.value();
 
   VMEnv env;
-  vm.emplace(&env);
-  vm->Load(syscall_stack_top);
-  g_vm = &vm.value();
+  cpus[0].emplace(0, &env);
+  cpus[0]->Init();
 
   LOG(INFO) << "Protection setup worked. Going to user mode";
 
@@ -153,27 +180,76 @@ void kmain(const char* multiboot_info) {
   g_interrupts = &interrupts.value();
   interrupts->Init();
 
-  scheduler.emplace(syscall_stack_top);
+  scheduler.emplace();
   g_scheduler = &scheduler.value();
+  futex_table.emplace();
+  g_futex_table = &futex_table.value();
+  work_queue.emplace();
+  g_work_queue = &work_queue.value();
+
+  // The boot page tables only map the first gigabyte. Switch to a full set of
+  // kernel mappings so that the local APIC registers are reachable.
+  idle_address_space = new AddressSpace();
+  idle_address_space->IncRef();
+  SwitchAddressSpace(idle_address_space->table_root());
+
+  tsc_clock.emplace();
+  tsc_clock->Calibrate(&io);
+  g_clock = &tsc_clock.value();
+
+  if (LocalApic::IsSupported()) {
+    local_apic.emplace();
+    g_local_apic = &local_apic.value();
+    local_apic->Enable();
+
+    apic_timer.emplace(&io, &local_apic.value());
+    g_timer = &apic_timer.value();
+  } else {
+    pit_timer.emplace(&io, &interrupts.value());
+    g_timer = &pit_timer.value();
+  }
 
-  LoadModules(multiboot_reader);
-
-  RefPtr<AddressSpace> idle_as = new AddressSpace();
-  Thread* idle_task = idle_as->CreateThread(virt_addr_t(&IdleTask), 2);
+  Thread* idle_task = idle_address_space->CreateThread(virt_addr_t(&IdleTask), Scheduler::kIdlePriority);
   idle_task->SetKernelThread();
-  idle_task->Start();
+  scheduler->InitCpu(&cpus[0].value(), idle_task);
+
+  // Without a local APIC there is no way to wake up the other CPUs.
+  if (g_local_apic) {
+    StartApplicationProcessors(&io, idle_address_space->table_root());
+  }
 
+  LoadModules(multiboot_reader);
+  work_queue->Start(idle_address_space);
+
+  // The scheduler programs the timer whenever it switches threads.
   scheduler->Start();
 
   // TODO:
-  // - Try to write drivers for keyboard, PS2 mouse, timer(?).
-  // - Preemptive multitasking with timer interrupt.
+  // - Try to write drivers for keyboard, PS2 mouse.
   // - System calls to create threads and address spaces, map memory, etc.
 
   // This code exits qemu.
   //outb(0xf4, 0);
 }
 
+// Entry point of the application processors, from ap_trampoline.s.
+void ApMain(int index) {
+  g_kernel_lock.Lock();
+
+  VMEnv env;
+  cpus[index].emplace(index, &env);
+  cpus[index]->Init();
+  g_local_apic->Enable();
+
+  LOG(INFO).Printf("CPU %d started, APIC id %u", index, cpus[index]->apic_id());
+
+  Thread* idle_task = idle_address_space->CreateThread(virt_addr_t(&IdleTask), Scheduler::kIdlePriority);
+  idle_task->SetKernelThread();
+  g_scheduler->InitCpu(&cpus[index].value(), idle_task);
+
+  g_scheduler->Start();
+}
+
 void __cxa_pure_virtual() {
   panic("Pure virtual function invoked");
 }
@@ -6,13 +6,19 @@
 #include "kernel/address_space.h"
 #include "base/assertions.h"
 #include "kernel/frame_allocator.h"
+#include "kernel/image_cache.h"
 #include "kernel/page_translation.h"
 #include "kernel/serial.h"
 #include "kernel/thread.h"
 
+static ImageCache g_image_cache;
+
 class ElfLoaderVisitor : public ElfVisitor {
 public:
-  ElfLoaderVisitor(const RefPtr<AddressSpace>& as) : address_space_(as) {}
+  // If |shared_image| is non-null, it is an identical, already loaded copy of
+  // |image|. Read-only segments are then mapped from it rather than from |image|.
+  ElfLoaderVisitor(const RefPtr<AddressSpace>& as, const char* image, const char* shared_image)
+    : address_space_(as), image_(image), shared_image_(shared_image) {}
 
   void LoadSegment(int flags, const char* data, size_t size, virt_addr_t load_addr, size_t load_size) override {
     LOG(INFO).Printf("  Loading segment (flags=%d) at %p, size=%d/%d", flags, (void*)load_addr, (int)size, (int)load_size);
@@ -24,13 +30,26 @@ public:
     attrs.set_writable(flags & kFlagWrite);
     attrs.set_no_execute(!(flags & kFlagExecute));
 
-    phys_addr_t phys_start = VirtualToPhysical(reinterpret_cast<virt_addr_t>(data));
+    bool shared = shared_image_ && !(flags & kFlagWrite);
+    const char* source = shared ? shared_image_ + (data - image_) : data;
+
+    phys_addr_t phys_start = VirtualToPhysical(reinterpret_cast<virt_addr_t>(source));
     phys_addr_t phys_end = phys_start + size;
 
     // Round phys_start down to page alignment. Round phys_end up to page alignment.
     phys_start = phys_start & ~(kPageSize - 1);
     phys_end = (phys_end + kPageSize - 1) & ~(kPageSize - 1);
 
+    if (shared_image_) {
+      phys_addr_t own_start = VirtualToPhysical(reinterpret_cast<virt_addr_t>(data)) & ~(kPageSize - 1);
+      Range own = {own_start, own_start + (phys_end - phys_start)};
+      if (shared) {
+        AddRange(shared_ranges_, &num_shared_ranges_, own);
+      } else {
+        AddRange(private_ranges_, &num_private_ranges_, own);
+      }
+    }
+
     virt_addr_t virt_start = load_addr;
     virt_addr_t virt_end = virt_start + size;
     virt_start = virt_start & ~(kPageSize - 1);
@@ -55,8 +74,55 @@ public:
     }
   }
 
+  // Returns the frames of |image| that were replaced by frames of the shared
+  // image to the frame allocator. Frames that also back a writable segment are
+  // kept. |image| must not be read after this.
+  void ReleaseSharedFrames() {
+    for (int i = 0; i < num_shared_ranges_; i++) {
+      const Range& range = shared_ranges_[i];
+      for (phys_addr_t frame = range.start; frame < range.end; frame += kPageSize) {
+        if (InRanges(private_ranges_, num_private_ranges_, frame)) continue;
+
+        // Two read-only segments may share a boundary frame. Only free it once.
+        if (InRanges(shared_ranges_, i, frame)) continue;
+
+        g_frame_allocator->FreeFrame(frame);
+        frames_released_++;
+      }
+    }
+  }
+
+  int frames_released() const { return frames_released_; }
+
 private:
+  struct Range {
+    phys_addr_t start;
+    phys_addr_t end;
+  };
+
+  static const int kMaxSegments = 16;
+
+  static void AddRange(Range* ranges, int* count, const Range& range) {
+    assert_lt(*count, kMaxSegments);
+    ranges[(*count)++] = range;
+  }
+
+  static bool InRanges(const Range* ranges, int count, phys_addr_t frame) {
+    for (int i = 0; i < count; i++) {
+      if (frame >= ranges[i].start && frame < ranges[i].end) return true;
+    }
+    return false;
+  }
+
   RefPtr<AddressSpace> address_space_;
+  const char* image_;
+  const char* shared_image_;
+
+  Range shared_ranges_[kMaxSegments];
+  int num_shared_ranges_ = 0;
+  Range private_ranges_[kMaxSegments];
+  int num_private_ranges_ = 0;
+  int frames_released_ = 0;
 };
 
 static bool StringIs(const char* start, const char* end, const char* cmp) {
@@ -151,6 +217,10 @@ static void ParseArguments(const char* args, MultibootDataVisitor* data, const R
     } else if (StringIs(key, end_key, "tid")) {
       int tid = ParseNum(10, value, end_value);
       thread->set_id(tid);
+    } else if (StringIs(key, end_key, "priority")) {
+      int priority = ParseNum(10, value, end_value);
+      if (priority >= Scheduler::kNumPriorities) panic("Invalid priority argument");
+      g_scheduler->SetPriority(thread, priority);
     } else {
       panic("Unrecognized command line argument");
     }
@@ -174,15 +244,26 @@ public:
     const char* data = reinterpret_cast<const char*>(start_addr);
     ElfReader reader(data, size);
 
-    ElfLoaderVisitor loader_visitor(as);
+    const char* shared_image = g_image_cache.Find(data, size);
+    ElfLoaderVisitor loader_visitor(as, data, shared_image);
     reader.Read(&loader_visitor);
 
-    Thread* thread = as->CreateThread(reader.entry_point(), 0,
+    if (shared_image) {
+      loader_visitor.ReleaseSharedFrames();
+      LOG(INFO).Printf("  Sharing read-only segments with an identical module (%d frames released)",
+                       loader_visitor.frames_released());
+    } else {
+      g_image_cache.Add(data, size);
+    }
+
+    Thread* thread = as->CreateThread(reader.entry_point(), Scheduler::kDefaultPriority,
                                       &data_->module_data(), sizeof(KernelModuleData));
 
     ParseArguments(args, data_, as, thread);
 
-    thread->Start();
+    if (!thread->Start()) {
+      panic("Thread ID of module taken or out of range");
+    }
   }
 
 private:
@@ -1,6 +1,7 @@
 ; -*- mode: nasm-mode; nasm-basic-offset: 2
 
 global loader
+global p4_table
 extern long_mode_start
 
   KERNEL_STACK_SIZE equ 32768
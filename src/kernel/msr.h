@@ -0,0 +1,50 @@
+#ifndef msr_h
+#define msr_h
+
+#include "base/types.h"
+
+const uint32_t kApicBaseMsr = 0x1b;
+const uint32_t kEferMsr = 0xc0000080;
+const uint32_t kStarMsr = 0xc0000081;
+const uint32_t kLStarMsr = 0xc0000082;
+const uint32_t kSfMaskMsr = 0xc0000084;
+const uint32_t kGsBaseMsr = 0xc0000101;
+const uint32_t kKernelGsBaseMsr = 0xc0000102;
+
+const uint64_t kEferSyscallEnable = 1 << 0;
+
+const uint64_t kRflagsTrap = 1 << 8;
+const uint64_t kRflagsInterrupt = 1 << 9;
+const uint64_t kRflagsDirection = 1 << 10;
+const uint64_t kRflagsNestedTask = 1 << 14;
+const uint64_t kRflagsAlignmentCheck = 1 << 18;
+
+inline uint64_t ReadMsr(uint32_t msr) {
+  uint32_t low, high;
+  asm volatile("rdmsr" : "=a"(low), "=d"(high) : "c"(msr));
+  return (uint64_t(high) << 32) | low;
+}
+
+inline void WriteMsr(uint32_t msr, uint64_t value) {
+  asm volatile("wrmsr" : : "c"(msr), "a"(uint32_t(value)), "d"(uint32_t(value >> 32)));
+}
+
+struct CpuidResult {
+  uint32_t eax, ebx, ecx, edx;
+};
+
+inline CpuidResult Cpuid(uint32_t leaf, uint32_t subleaf = 0) {
+  CpuidResult r;
+  asm volatile("cpuid"
+               : "=a"(r.eax), "=b"(r.ebx), "=c"(r.ecx), "=d"(r.edx)
+               : "a"(leaf), "c"(subleaf));
+  return r;
+}
+
+inline uint64_t ReadTsc() {
+  uint32_t low, high;
+  asm volatile("rdtsc" : "=a"(low), "=d"(high));
+  return (uint64_t(high) << 32) | low;
+}
+
+#endif  // msr_h
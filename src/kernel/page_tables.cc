@@ -19,6 +19,14 @@ static const uint64_t kNoExecute = uint64_t(1) << 63;
 static const uint64_t kPhysicalPageShift = 12;
 static const uint64_t kPageTableBits = 40;
 
+static const int kTableBits = 9;
+static const int kTableMask = (1 << kTableBits) - 1;
+static const int kNumTables = 4;
+
+static phys_addr_t EntryAddress(uint64_t entry) {
+  return ((entry >> kPhysicalPageShift) & ((uint64_t(1) << kPageTableBits) - 1)) << kPhysicalPageShift;
+}
+
 PageTableManager::PageTableManager() {
   table_ = g_frame_allocator->AllocateFrame();
   ClearTable(table_);
@@ -32,10 +40,6 @@ void PageTableManager::ClearTable(phys_addr_t table) {
 void PageTableManager::Map(phys_addr_t phys_start, phys_addr_t phys_end,
                            virt_addr_t virt_start, virt_addr_t virt_end,
                            const PageAttributes& attrs) {
-  static const int kTableBits = 9;
-  static const int kTableMask = (1 << kTableBits) - 1;
-  static const int kNumTables = 4;
-
   assert_eq(phys_start & (kPageSize - 1), 0);
   assert_eq(phys_end & (kPageSize - 1), 0);
   assert_eq(virt_start & (kPageSize - 1), 0);
@@ -79,7 +83,7 @@ void PageTableManager::Map(phys_addr_t phys_start, phys_addr_t phys_end,
         *entryp = phys | flags;
       } else {
         if (*entryp & kPresent) {
-          table = ((*entryp >> kPhysicalPageShift) & ((uint64_t(1) << kPageTableBits) - 1)) << kPhysicalPageShift;
+          table = EntryAddress(*entryp);
         } else {
           table = g_frame_allocator->AllocateFrame();
           ClearTable(table);
@@ -91,3 +95,32 @@ void PageTableManager::Map(phys_addr_t phys_start, phys_addr_t phys_end,
     virt += page_size;
   }
 }
+
+bool PageTableManager::Translate(virt_addr_t virt, phys_addr_t* phys, PageAttributes* attrs) const {
+  phys_addr_t table = table_;
+  for (int i = kNumTables - 1; i >= 0; i--) {
+    const uint64_t* tablep = reinterpret_cast<const uint64_t*>(PhysicalToVirtual(table));
+    int entry_index = (virt >> (kPhysicalPageShift + i * kTableBits)) & kTableMask;
+    uint64_t entry = tablep[entry_index];
+    if (!(entry & kPresent)) return false;
+
+    if (i == 0 || (entry & kLargerPage)) {
+      // For larger pages, the low bits of the address hold the PAT bit.
+      uint64_t offset_mask = (uint64_t(1) << (kPhysicalPageShift + i * kTableBits)) - 1;
+      *phys = (EntryAddress(entry) & ~offset_mask) | (virt & offset_mask);
+
+      if (attrs) {
+        attrs->set_present(true);
+        attrs->set_writable(entry & kWritable);
+        attrs->set_user_accessible(entry & kUserAccessible);
+        attrs->set_global(entry & kGlobalPage);
+        attrs->set_no_execute(entry & kNoExecute);
+      }
+      return true;
+    }
+
+    table = EntryAddress(entry);
+  }
+
+  return false;
+}
@@ -33,6 +33,10 @@ public:
            virt_addr_t virt_start, virt_addr_t virt_end,
            const PageAttributes& attrs);
 
+  // Looks up the physical address |virt| maps to. Returns false if it isn't
+  // mapped. The attributes are those of the page, not of the tables above it.
+  bool Translate(virt_addr_t virt, phys_addr_t* phys, PageAttributes* attrs = nullptr) const;
+
   phys_addr_t table_root() const { return table_; }
 
 private:
@@ -216,6 +216,63 @@ TEST(PageTablesTest, HugePages) {
   EXPECT_EQ(entry, phys + kLargePageSize);
 }
 
+TEST(PageTablesTest, Translate) {
+  PageTableManager tables;
+
+  PageAttributes attrs;
+  attrs.set_writable(false).set_no_execute(true);
+
+  phys_addr_t phys = kPageSize * 5;
+  virt_addr_t virt = MakeAddressForTables(1, 2, 3, 4);
+  tables.Map(phys, phys + 2 * kPageSize, virt, virt + 2 * kPageSize, attrs);
+
+  phys_addr_t result;
+  PageAttributes result_attrs;
+  ASSERT_TRUE(tables.Translate(virt + 123, &result, &result_attrs));
+  EXPECT_EQ(result, phys + 123);
+  EXPECT_FALSE(result_attrs.writable());
+  EXPECT_TRUE(result_attrs.user_accessible());
+  EXPECT_TRUE(result_attrs.no_execute());
+
+  ASSERT_TRUE(tables.Translate(virt + kPageSize + 7, &result));
+  EXPECT_EQ(result, phys + kPageSize + 7);
+
+  EXPECT_FALSE(tables.Translate(virt + 2 * kPageSize, &result));
+  EXPECT_FALSE(tables.Translate(MakeAddressForTables(9, 2, 3, 4), &result));
+}
+
+TEST(PageTablesTest, TranslateNotPresent) {
+  PageTableManager tables;
+
+  PageAttributes attrs;
+  attrs.set_present(false);
+
+  virt_addr_t virt = MakeAddressForTables(1, 2, 3, 4);
+  tables.Map(0, 0, virt, virt + kPageSize, attrs);
+
+  phys_addr_t result;
+  EXPECT_FALSE(tables.Translate(virt, &result));
+}
+
+TEST(PageTablesTest, TranslateLargerPages) {
+  PageTableManager tables;
+
+  PageAttributes attrs;
+
+  phys_addr_t phys = kHugePageSize;
+  virt_addr_t virt = MakeAddressForTables(38, 147, 0, 0);
+  tables.Map(phys, phys + kHugePageSize + kLargePageSize,
+             virt, virt + kHugePageSize + kLargePageSize,
+             attrs);
+
+  phys_addr_t result;
+  ASSERT_TRUE(tables.Translate(virt + 0x12345678, &result));
+  EXPECT_EQ(result, phys + 0x12345678);
+
+  ASSERT_TRUE(tables.Translate(virt + kHugePageSize + 0x1234, &result));
+  EXPECT_EQ(result, phys + kHugePageSize + 0x1234);
+}
+
 int main(int argc, char** argv) {
   testing::InitGoogleTest(&argc, argv);
 
@@ -6,7 +6,8 @@
 #include "string.h"
 #include "thread.h"
 
-VM* g_vm;
+InterruptDescriptor::Storage VM::idt_[kNumIDTEntries];
+bool VM::idt_initialized_ = false;
 
 namespace {
 
@@ -233,7 +234,7 @@ extern void syscall_handler();
 extern void load_cs_selector();
 }
 
-void VM::Load(virt_addr_t syscall_stack_top) {
+void VM::Load() {
   // Kernel code segment.
   AddGDTEntry(kKernelCodeSegmentIndex,
               SegmentDescriptor().set_required_privileges(kKernelPrivilege).set_type(SegmentDescriptor::kCodeSegment));
@@ -250,11 +251,10 @@ void VM::Load(virt_addr_t syscall_stack_top) {
   AddGDTEntry(kUserStackSegmentIndex,
               SegmentDescriptor().set_required_privileges(kUserPrivilege).set_type(SegmentDescriptor::kDataSegment));
 
-  // TSS.
-  TaskStateSegment tss;
-  tss.set_privileged_stack(0, syscall_stack_top);
-  tss.set_interrupt_stack(1, syscall_stack_top);
-  tss.Serialize(tss_);
+  // TSS. Interrupts from user space land on the kernel stack of the running
+  // thread, which the scheduler fills in whenever it switches threads.
+  // Interrupts in kernel mode stay on the stack they came in on.
+  SetKernelStack(0);
 
   SegmentDescriptor tss_desc;
   tss_desc.set_type(SegmentDescriptor::kTaskStateSegment);
@@ -266,16 +266,26 @@ void VM::Load(virt_addr_t syscall_stack_top) {
 
   env_->LoadTSS(SegmentSelector(kTSSIndex));
 
-  LOG(INFO).Printf("Handler table = %p", interrupt_handler_table);
+  if (!idt_initialized_) {
+    LOG(INFO).Printf("Handler table = %p", interrupt_handler_table);
 
-  for (int i = 0; interrupt_handler_table[i].handler != 0; i++) {
-    const InterruptHandlerEntry& entry = interrupt_handler_table[i];
-    LOG(DEBUG).Printf("Handler %d = %d/%p", i, entry.number, (void*)entry.handler);
-    AddIDTEntry(entry.number, InterruptDescriptor().set_offset(entry.handler).set_interrupt_stack(1));
-  }
+    for (int i = 0; interrupt_handler_table[i].handler != 0; i++) {
+      const InterruptHandlerEntry& entry = interrupt_handler_table[i];
+      LOG(DEBUG).Printf("Handler %d = %d/%p", i, entry.number, (void*)entry.handler);
+      AddIDTEntry(entry.number, InterruptDescriptor().set_offset(entry.handler));
+    }
+
+    // The system call handler.
+    AddIDTEntry(0x80, InterruptDescriptor().set_offset(reinterpret_cast<virt_addr_t>(syscall_handler)));
 
-  // The system call handler.
-  AddIDTEntry(0x80, InterruptDescriptor().set_offset(reinterpret_cast<virt_addr_t>(syscall_handler)).set_interrupt_stack(1));
+    idt_initialized_ = true;
+  }
 
   env_->LoadIDT(virt_addr_t(&idt_), kNumIDTEntries * sizeof(InterruptDescriptor::Storage));
 }
+
+void VM::SetKernelStack(virt_addr_t stack_top) {
+  TaskStateSegment tss;
+  tss.set_privileged_stack(0, stack_top);
+  tss.Serialize(tss_);
+}
@@ -7,10 +7,12 @@
 const int kKernelPrivilege = 0;
 const int kUserPrivilege = 3;
 
+// Warning: The order is fixed by syscall/sysret (see Cpu::Init), and
+// interrupt_handlers.s has the user selectors hardcoded.
 const int kKernelCodeSegmentIndex = 1;
 const int kKernelStackSegmentIndex = 2;
-const int kUserCodeSegmentIndex = 3;
-const int kUserStackSegmentIndex = 4;
+const int kUserStackSegmentIndex = 3;
+const int kUserCodeSegmentIndex = 4;
 const int kTSSIndex = 5;
 
 class SegmentSelector {
@@ -117,27 +119,32 @@ public:
   virtual void LoadTSS(const SegmentSelector& selector);
 };
 
+// The descriptor tables of one CPU.
 class VM {
 public:
   VM(VMEnv* env);
 
-  void Load(virt_addr_t syscall_stack_top);
+  void Load();
+
+  // Sets the stack the CPU switches to when an interrupt comes in from user
+  // space.
+  void SetKernelStack(virt_addr_t stack_top);
 
 private:
   void AddGDTEntry(int number, const SegmentDescriptor& segdesc);
-  void AddIDTEntry(int number, const InterruptDescriptor& desc);
+  static void AddIDTEntry(int number, const InterruptDescriptor& desc);
 
   VMEnv* const env_;
 
   static const int kNumGDTEntries = 8;
   SegmentDescriptor::Storage gdt_[kNumGDTEntries] __attribute__((aligned(8))) = {};
 
+  // The IDT is the same on every CPU, so it is built once and shared.
   static const int kNumIDTEntries = 256;
-  InterruptDescriptor::Storage idt_[kNumIDTEntries] __attribute__((aligned(8))) = {};
+  static InterruptDescriptor::Storage idt_[kNumIDTEntries] __attribute__((aligned(8)));
+  static bool idt_initialized_;
 
   TaskStateSegment::Storage tss_ __attribute__((aligned(8))) = {};
 };
 
-extern VM* g_vm;
-
 #endif  // protection_h
@@ -0,0 +1,71 @@
+#include "smp.h"
+
+#include "base/assertions.h"
+#include "kernel/apic.h"
+#include "kernel/cpu.h"
+#include "kernel/page_translation.h"
+#include "kernel/serial.h"
+#include "kernel/timer.h"
+
+#include <string.h>
+
+// Real mode code has to start below 1MB, on a page boundary. This page is
+// never handed out by the frame allocator.
+static const phys_addr_t kApTrampolineAddress = 0x8000;
+
+static char ap_stacks[kMaxCpus][kApStackSize] __attribute__((aligned(16)));
+
+extern "C" {
+extern char ap_trampoline_start[];
+extern char ap_trampoline_end[];
+extern char ap_trampoline_boot_tables[];
+extern char ap_trampoline_kernel_tables[];
+extern char ap_trampoline_stacks[];
+extern char ap_trampoline_next_index[];
+extern char ap_trampoline_max_index[];
+
+// The boot page tables from loader32.s. They identity map the first gigabyte.
+extern char p4_table[];
+}
+
+// Returns a pointer to |symbol| in the copy of the trampoline.
+template <typename T>
+static T* TrampolineVariable(char* symbol) {
+  virt_addr_t copy = PhysicalToVirtual(kApTrampolineAddress);
+  return reinterpret_cast<T*>(copy + (symbol - ap_trampoline_start));
+}
+
+int StartApplicationProcessors(IoPorts* io, phys_addr_t kernel_tables) {
+  assert(g_local_apic);
+
+  size_t size = ap_trampoline_end - ap_trampoline_start;
+  assert_le(size, kPageSize);
+  memcpy(reinterpret_cast<void*>(PhysicalToVirtual(kApTrampolineAddress)), ap_trampoline_start, size);
+
+  *TrampolineVariable<uint64_t>(ap_trampoline_boot_tables) = reinterpret_cast<uint64_t>(p4_table);
+  *TrampolineVariable<uint64_t>(ap_trampoline_kernel_tables) = kernel_tables;
+  *TrampolineVariable<uint64_t>(ap_trampoline_stacks) = reinterpret_cast<uint64_t>(ap_stacks);
+  *TrampolineVariable<uint32_t>(ap_trampoline_max_index) = kMaxCpus;
+  volatile uint32_t* next_index = TrampolineVariable<uint32_t>(ap_trampoline_next_index);
+  *next_index = 1;
+
+  // The INIT-SIPI-SIPI sequence from the Intel MP specification.
+  g_local_apic->SendInitToOthers();
+  PitTimer::BusyWait(io, 10000);
+  g_local_apic->SendStartupToOthers(kApTrampolineAddress / kPageSize);
+  PitTimer::BusyWait(io, 200);
+  g_local_apic->SendStartupToOthers(kApTrampolineAddress / kPageSize);
+
+  // There's no way to ask how many CPUs there are without parsing the ACPI
+  // tables, so give them some time to show up.
+  PitTimer::BusyWait(io, 20000);
+
+  int num_cpus = __atomic_load_n(next_index, __ATOMIC_ACQUIRE);
+  if (num_cpus > kMaxCpus) {
+    LOG(WARNING).Printf("Ignoring %d CPUs past the first %d", num_cpus - kMaxCpus, kMaxCpus);
+    num_cpus = kMaxCpus;
+  }
+
+  LOG(INFO).Printf("%d CPUs online", num_cpus);
+  return num_cpus;
+}
@@ -0,0 +1,15 @@
+#ifndef smp_h
+#define smp_h
+
+#include "base/io.h"
+#include "base/types.h"
+
+// Boot stack of each application processor. Only used until it starts scheduling.
+const size_t kApStackSize = 16384;
+
+// Wakes up the other CPUs. Each one switches to |kernel_tables| and calls
+// ApMain(index) with its CPU index, starting at 1. They all block on the
+// kernel lock, so the caller must hold it. Returns the total number of CPUs.
+int StartApplicationProcessors(IoPorts* io, phys_addr_t kernel_tables);
+
+#endif  // smp_h
@@ -0,0 +1,30 @@
+#ifndef spinlock_h
+#define spinlock_h
+
+#include "base/types.h"
+
+class SpinLock {
+public:
+  void Lock() {
+    while (__atomic_exchange_n(&locked_, 1, __ATOMIC_ACQUIRE)) {
+      while (__atomic_load_n(&locked_, __ATOMIC_RELAXED)) {
+        asm volatile("pause");
+      }
+    }
+  }
+
+  void Unlock() {
+    __atomic_store_n(&locked_, 0, __ATOMIC_RELEASE);
+  }
+
+private:
+  // Warning: interrupt_handlers.s manipulates bit 0 of this directly.
+  uint64_t locked_ = 0;
+};
+
+// Held by whichever CPU is running kernel code. The entry and exit paths in
+// interrupt_handlers.s take and drop it, so only boot code and kernel threads
+// need to take it explicitly.
+extern "C" SpinLock g_kernel_lock;
+
+#endif  // spinlock_h
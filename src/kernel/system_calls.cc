@@ -1,8 +1,11 @@
 #include "base/assertions.h"
 #include "base/types.h"
+#include "kernel/batch.h"
+#include "kernel/futex.h"
 #include "kernel/interrupts.h"
 #include "kernel/serial.h"
 #include "kernel/thread.h"
+#include "kernel/trace.h"
 
 typedef void (*GenericSysCall)();
 
@@ -22,16 +25,17 @@ void SysExitThread() {
   g_scheduler->ExitThread();
 }
 
-void SysSend(int dest_tid, int type, uint64_t payload) {
-  g_scheduler->current_thread()->Send(dest_tid, type, payload);
+// The message passing calls find the message in the registers saved on entry.
+void SysSend(int dest_tid) {
+  g_scheduler->current_thread()->Send(dest_tid);
 }
 
-void SysReceive(int* sender_tid, int* type, uint64_t* payload) {
-  g_scheduler->current_thread()->Receive(sender_tid, type, payload);
+void SysReceive() {
+  g_scheduler->current_thread()->Receive();
 }
 
-void SysNotify(int notify_tid) {
-  g_scheduler->current_thread()->Notify(notify_tid);
+void SysNotify(int notify_tid, uint64_t bits) {
+  g_scheduler->current_thread()->Notify(notify_tid, bits);
 }
 
 void SysRequestInterrupt(int irq) {
@@ -46,6 +50,117 @@ void SysAckInterrupt(int irq) {
   g_interrupts->Acknowledge(irq);
 }
 
+void SysReceiveTimeout(uint64_t timeout_ns) {
+  g_scheduler->current_thread()->Receive(timeout_ns);
+}
+
+void SysSleep(uint64_t ns) {
+  g_scheduler->Sleep(ns);
+}
+
+void SysNop() {
+}
+
+void SysCall(int dest_tid) {
+  g_scheduler->current_thread()->Call(dest_tid);
+}
+
+void SysReplyWait(int reply_tid) {
+  g_scheduler->current_thread()->ReplyWait(reply_tid);
+}
+
+void SysSetReceiveBuffer(void* buffer, size_t size) {
+  g_scheduler->current_thread()->SetReceiveBuffer(virt_addr_t(buffer), size);
+}
+
+void SysUnmapShared(void* addr, size_t size) {
+  Thread* thread = g_scheduler->current_thread();
+  virt_addr_t start = virt_addr_t(addr);
+  thread->SetReturnValue(thread->address_space()->Unmap(start, start + size));
+}
+
+void SysSendTimeout(int dest_tid) {
+  Thread* thread = g_scheduler->current_thread();
+  thread->Send(dest_tid, thread->ipc_timeout());
+}
+
+void SysCallTimeout(int dest_tid) {
+  Thread* thread = g_scheduler->current_thread();
+  thread->Call(dest_tid, thread->ipc_timeout());
+}
+
+void SysReceiveFiltered(uint64_t timeout_ns, int from_tid, int type) {
+  g_scheduler->current_thread()->Receive(timeout_ns, from_tid, type);
+}
+
+void SysCreateThread(virt_addr_t start_func, int priority, uint64_t arg) {
+  // FIXME: Lock this down so only some processes can use high priorities.
+  Thread* current = g_scheduler->current_thread();
+  if (priority < 0 || priority >= Scheduler::kIdlePriority) {
+    current->SetReturnValue(0);
+    return;
+  }
+
+  // The new thread gets a pointer to its copy of |arg|.
+  Thread* thread = current->address_space()->CreateThread(start_func, priority, &arg, sizeof(arg));
+  if (!thread->Start()) {
+    delete thread;
+    current->SetReturnValue(0);
+    return;
+  }
+  current->SetReturnValue(thread->id());
+}
+
+void SysSetPriority(int tid, int priority) {
+  // FIXME: Lock this down so only some processes can raise priorities.
+  Thread* current = g_scheduler->current_thread();
+  if (priority < 0 || priority >= Scheduler::kIdlePriority) {
+    current->SetReturnValue(false);
+    return;
+  }
+
+  Thread* thread = g_scheduler->FindThread(tid);
+  if (!thread) {
+    current->SetReturnValue(false);
+    return;
+  }
+
+  current->SetReturnValue(g_scheduler->SetPriority(thread, priority));
+}
+
+void SysYieldToPriority(int priority) {
+  if (priority < 0 || priority >= Scheduler::kNumPriorities) return;
+  g_scheduler->YieldToPriority(priority);
+}
+
+void SysSubmitBatch(void* ring) {
+  Thread* thread = g_scheduler->current_thread();
+  thread->SetReturnValue(ProcessBatch(thread, virt_addr_t(ring)));
+
+  // Let anything more urgent the batch woke up run now.
+  g_scheduler->CheckPreempt();
+}
+
+void SysFutexWait(uint32_t* addr, uint32_t expected, uint64_t timeout_ns) {
+  g_futex_table->Wait(g_scheduler->current_thread(), virt_addr_t(addr), expected, timeout_ns);
+}
+
+void SysFutexWake(uint32_t* addr, int count) {
+  Thread* thread = g_scheduler->current_thread();
+  thread->SetReturnValue(g_futex_table->Wake(thread, virt_addr_t(addr), count));
+  g_scheduler->CheckPreempt();
+}
+
+void SysGetThreadStats(ThreadStatsRecord* records, int max_records) {
+  Thread* thread = g_scheduler->current_thread();
+  if (max_records < 0) max_records = 0;
+  thread->SetReturnValue(g_scheduler->CopyThreadStats(thread, virt_addr_t(records), max_records));
+}
+
+void SysDumpTrace() {
+  DumpTrace();
+}
+
 #define REGISTER_SYSCALL(fn) reinterpret_cast<GenericSysCall>(fn)
 extern "C" {
 GenericSysCall syscall_handler_table[256] = {
@@ -58,6 +173,24 @@ GenericSysCall syscall_handler_table[256] = {
   REGISTER_SYSCALL(SysNotify),
   REGISTER_SYSCALL(SysRequestInterrupt),
   REGISTER_SYSCALL(SysAckInterrupt),
+  REGISTER_SYSCALL(SysSetPriority),
+  REGISTER_SYSCALL(SysYieldToPriority),
+  REGISTER_SYSCALL(SysSleep),
+  REGISTER_SYSCALL(SysReceiveTimeout),
+  REGISTER_SYSCALL(SysNop),
+  REGISTER_SYSCALL(SysCall),
+  REGISTER_SYSCALL(SysReplyWait),
+  REGISTER_SYSCALL(SysSetReceiveBuffer),
+  REGISTER_SYSCALL(SysUnmapShared),
+  REGISTER_SYSCALL(SysSendTimeout),
+  REGISTER_SYSCALL(SysCallTimeout),
+  REGISTER_SYSCALL(SysReceiveFiltered),
+  REGISTER_SYSCALL(SysCreateThread),
+  REGISTER_SYSCALL(SysSubmitBatch),
+  REGISTER_SYSCALL(SysFutexWait),
+  REGISTER_SYSCALL(SysFutexWake),
+  REGISTER_SYSCALL(SysGetThreadStats),
+  REGISTER_SYSCALL(SysDumpTrace),
 };
 }
 
@@ -1,254 +1,1215 @@
 #include "thread.h"
 
 #include "base/assertions.h"
+#include "kernel/apic.h"
+#include "kernel/clock.h"
+#include "kernel/fpu.h"
 #include "kernel/frame_allocator.h"
 #include "kernel/interrupts.h"
 #include "kernel/page_translation.h"
 #include "kernel/protection.h"
 #include "kernel/serial.h"
+#include "kernel/timer.h"
+#include "kernel/trace.h"
+#include "kernel/work_queue.h"
+
+extern "C" {
+void SwitchAddressSpace(phys_addr_t tables);
+void SwitchKernelContext(uint64_t* save_rsp, uint64_t load_rsp);
+void ResumeKernelContext(uint64_t load_rsp);
+void thread_start();
+
+// For interrupt_handlers.s.
+void SwitchKernelStacks() {
+  g_scheduler->SwitchKernelStacks();
+}
+
+void FinishKernelSwitch() {
+  g_scheduler->FinishSwitch();
+}
+}
+
+// What SwitchKernelContext pushes on top of the return address: rbx, rbp and
+// r12 to r15.
+static const int kKernelContextRegisters = 6;
 
 Scheduler* g_scheduler;
-int g_thread_id = 32;
 
 Thread::Thread(virt_addr_t start_func,
                virt_addr_t stack_ptr,
                const RefPtr<AddressSpace>& address_space,
                int priority)
-  : id_(g_thread_id++),
-    state_{},
+  : state_{},
     address_space_(address_space),
-    priority_(priority) {
-  assert_lt(priority, Scheduler::kNumQueues);
+    priority_(priority),
+    base_priority_(priority) {
+  assert_ge(priority, 0);
+  assert_lt(priority, Scheduler::kNumPriorities);
 
   state_.rip = start_func;
   state_.cs = SegmentSelector(kUserCodeSegmentIndex, kUserPrivilege).Serialize();
   state_.rflags = (1 << 9); // Enable interrupts.
-  state_.rsp = stack_ptr;
+  // As if the entry function had been called: the ABI wants rsp + 8 to be
+  // 16-byte aligned, which SSE code relies on.
+  state_.rsp = (stack_ptr & ~virt_addr_t(15)) - 8;
   state_.ss = SegmentSelector(kUserStackSegmentIndex, kUserPrivilege).Serialize();
 
   // This allows us to pass in thread data as an argument.
   state_.rdi = stack_ptr;
+
+  // The first switch to the thread returns to thread_start, which leaves the
+  // kernel with the state above.
+  kernel_stack_ = g_frame_allocator->AllocateFrame();
+  uint64_t* stack = reinterpret_cast<uint64_t*>(PhysicalToVirtual(kernel_stack_) + kPageSize);
+  *--stack = reinterpret_cast<uint64_t>(&thread_start);
+  for (int i = 0; i < kKernelContextRegisters; i++) {
+    *--stack = 0;
+  }
+  kernel_rsp_ = reinterpret_cast<uint64_t>(stack);
 }
 
 Thread::~Thread() {
   assert(!thread_links.InList());
-  g_scheduler->RemoveThread(this);
+  assert(!waiting_on_);
+  g_frame_allocator->FreeFrame(kernel_stack_);
+  if (fpu_state_) {
+    delete fpu_state_;
+  }
+}
 
-  // FIXME: Would be good to have a general notification mechanism for when a thread exits.
-  g_interrupts->UnregisterForInterrupts(this);
+// Runs on a worker thread (work_queue.h).
+static void DeleteThread(void* thread) {
+  delete static_cast<Thread*>(thread);
 }
 
 void Thread::SetKernelThread() {
   state_.cs = SegmentSelector(kKernelCodeSegmentIndex, kKernelPrivilege).Serialize();
   state_.ss = SegmentSelector(kKernelStackSegmentIndex, kKernelPrivilege).Serialize();
+
+  // Interrupts don't switch stacks without a change of privilege, so they
+  // land on whatever stack the thread is on. Use the kernel stack, which
+  // stays mapped whichever address space the interrupt switches to.
+  state_.rsp = PhysicalToVirtual(kernel_stack_) + kPageSize;
 }
 
 void Thread::AllowIo() {
   state_.rflags |= 3 << 12; // Set the IOPL to 3.
 }
 
-void Thread::Start() {
+bool Thread::Start() {
   assert_eq(status_, kStarting);
+  if (!g_scheduler->AddThread(this)) {
+    return false;
+  }
+
   status_ = kRunnable;
-  g_scheduler->AddThread(this);
+  g_scheduler->PlaceThread(this);
   g_scheduler->Enqueue(this);
+  return true;
 }
 
-void Thread::Send(int dest_tid, int type, uint64_t payload) {
-  Thread* dest = g_scheduler->FindThread(dest_tid);
-  // FIXME: Check for null dest.
-  if (dest->status_ == kBlockedReceiving) {
-    g_scheduler->RunThread(dest, true);
+// Where the words of a message live in ThreadState.
+static uint64_t ThreadState::* const kMessageWords[kMaxMessageWords] = {
+  &ThreadState::rdx,
+  &ThreadState::r10,
+  &ThreadState::r8,
+  &ThreadState::r9,
+  &ThreadState::r12,
+  &ThreadState::r13,
+};
+
+bool Thread::Accepts(const Thread* sender) const {
+  if (!sender) {
+    // Notifications only go to receives without a filter.
+    return status_ == kBlockedReceiving && !receive_from_ && receive_type_ == kAnyType;
+  }
+
+  return Accepts(sender->id(), sender->state_.rsi);
+}
 
-    // This must happen *after* RunThread so we're in the AS of the recipient.
-    // Warning: This is writing directly into the userspace. Could get page faults
-    // and maybe other exceptions? Need to handle this!
-    ReceiveInfo& info = dest->receive_info_;
-    *info.sender_tid = id();
-    *info.type = type;
-    *info.payload = payload;
+bool Thread::Accepts(int sender_id, uint64_t tag) const {
+  if (status_ != kBlockedReceiving) return false;
+
+  // A thread waiting in Call only takes the reply.
+  return Matches(sender_id, tag, receive_from_, receive_type_);
+}
+
+bool Thread::Matches(int sender_id, uint64_t tag, int from_tid, int type) {
+  if (from_tid && from_tid != sender_id) return false;
+  return type == kAnyType || type == int(tag & 0xffffffff);
+}
+
+void Thread::DeliverMessage(Thread* sender) {
+  sender->stats_.messages_sent++;
+  stats_.messages_received++;
+
+  const ThreadState& from = sender->state_;
+  uint64_t words[kMaxMessageWords];
+  for (int i = 0; i < kMaxMessageWords; i++) {
+    words[i] = from.*kMessageWords[i];
+  }
+
+  DeliverWords(sender->id(), from.rsi, words);
+  if (from.rsi & kLongMessage) {
+    DeliverLongMessage(sender);
+  }
+}
+
+void Thread::DeliverWords(int sender_id, uint64_t tag, const uint64_t* words) {
+  Trace(kTraceReceive, id(), sender_id);
+
+  // This is the reply to our Call.
+  if (waiting_on_) {
+    StopWaiting();
+  }
+
+  bool is_long = tag & kLongMessage;
+  uint64_t length = (tag >> kMessageLengthShift) & kMessageLengthMask;
+  if (length > kMaxMessageWords) {
+    length = kMaxMessageWords;
+  }
+  if (is_long && length < 2) {
+    length = 2;
+  }
+
+  state_.rax = sender_id;
+  state_.rsi = (is_long ? kLongMessage : 0) | (length << kMessageLengthShift) | (tag & 0xffffffff);
+  for (int i = 0; i < kMaxMessageWords; i++) {
+    state_.*kMessageWords[i] = uint64_t(i) < length ? words[i] : 0;
+  }
+
+  receive_from_ = 0;
+  receive_type_ = kAnyType;
+}
+
+void Thread::Wake() {
+  status_ = kRunnable;
+  g_scheduler->Enqueue(this);
+}
+
+void Thread::DeliverNotifications() {
+  assert(notifications_);
+  Trace(kTraceReceive, id(), 0);
+
+  // Everything that came in since the last Receive arrives at once.
+  state_.rax = 0;
+  state_.rsi = uint64_t(1) << kMessageLengthShift;
+  for (int i = 0; i < kMaxMessageWords; i++) {
+    state_.*kMessageWords[i] = 0;
+  }
+  state_.rdx = notifications_;
+  notifications_ = 0;
+
+  receive_from_ = 0;
+  receive_type_ = kAnyType;
+}
+
+void Thread::DeliverLongMessage(const Thread* sender) {
+  virt_addr_t buffer = sender->state_.rdx;
+  size_t size = sender->state_.r10;
+  bool must_share = sender->state_.rsi & kSharedPages;
+
+  // Sharing costs a page table update per page and a range of our address
+  // space, which only pays off for big buffers, unless the sender wants
+  // shared memory to begin with. Only then may we write to the pages: a
+  // message that just happens to be big must not let the receiver scribble
+  // over the sender's memory.
+  if ((must_share || size >= kShareThreshold) && (buffer & (kPageSize - 1)) == 0) {
+    virt_addr_t shared = address_space_->Share(sender->address_space_.value(), buffer, size,
+                                               must_share);
+    if (shared) {
+      state_.rsi |= kSharedPages;
+      state_.rdx = shared;
+      return;
+    }
+  }
+
+  if (must_share) {
+    state_.rdx = 0;
+    state_.r10 = 0;
+    return;
+  }
+
+  // Whatever doesn't fit in the receive buffer is dropped. The receiver sees
+  // how much arrived.
+  if (size > receive_buffer_size_) {
+    size = receive_buffer_size_;
+  }
+  if (!AddressSpace::Copy(address_space_.value(), receive_buffer_,
+                          sender->address_space_.value(), buffer, size)) {
+    size = 0;
+  }
+
+  state_.rdx = receive_buffer_;
+  state_.r10 = size;
+}
+
+void Thread::WaitOn(Thread* server, bool for_reply) {
+  assert(!waiting_on_);
+  if (for_reply) {
+    server->reply_waiters_.PushBack(thread_links);
   } else {
-    send_info_.sender_tid = id();
-    send_info_.type = type;
-    send_info_.payload = payload;
+    server->QueueSender(this);
+  }
+  waiting_on_ = server;
+  g_scheduler->UpdateInheritedPriority(server);
+}
+
+void Thread::QueueSender(Thread* sender) {
+  // Most senders share a priority, so the place is usually found right at
+  // the back.
+  for (auto it = send_queue_.rbegin(); it; ++it) {
+    if (it->priority_ <= sender->priority_) {
+      it->thread_links.InsertAfter(sender->thread_links);
+      return;
+    }
+  }
+  send_queue_.PushFront(sender->thread_links);
+}
+
+void Thread::StopWaiting() {
+  Thread* server = waiting_on_;
+  assert(server);
+  thread_links.Remove();
+  waiting_on_ = nullptr;
+  g_scheduler->UpdateInheritedPriority(server);
+}
+
+void Thread::ReleaseWaiters() {
+  auto release = [](Thread* waiter) {
+    waiter->waiting_on_ = nullptr;
+    waiter->receive_from_ = 0;
+    waiter->receive_type_ = kAnyType;
+    waiter->SetReturnValue(uint64_t(kNoSuchThread));
+    waiter->Wake();
+  };
+
+  while (!send_queue_.IsEmpty()) {
+    release(send_queue_.PopFront());
+  }
+  while (!reply_waiters_.IsEmpty()) {
+    release(reply_waiters_.PopFront());
+  }
+}
+
+void Thread::SetReceiveBuffer(virt_addr_t buffer, size_t size) {
+  receive_buffer_ = buffer;
+  receive_buffer_size_ = size;
+}
 
-    dest->send_queue_.PushBack(thread_links);
+void Thread::Send(int dest_tid, uint64_t timeout_ns) {
+  Trace(kTraceSend, id(), dest_tid);
+  Thread* dest = g_scheduler->FindThread(dest_tid);
+  if (!dest) {
+    SetReturnValue(uint64_t(kNoSuchThread));
+    return;
+  }
+
+  if (dest->Accepts(this)) {
+    SetReturnValue(0);
+    dest->DeliverMessage(this);
+    g_scheduler->RunThread(dest, true);
+  } else if (timeout_ns == 0) {
+    SetReturnValue(uint64_t(kWouldBlock));
+  } else if (timeout_ns != kNoTimeout &&
+             !g_scheduler->AddTimeout(this, g_clock->Deadline(timeout_ns))) {
+    SetReturnValue(uint64_t(kTooManyTimeouts));
+  } else {
+    // The message stays in our registers until the receiver picks it up.
+    SetReturnValue(0);
+    WaitOn(dest, /*for_reply=*/ false);
     status_ = kBlockedSending;
     g_scheduler->Reschedule(false);
   }
 }
 
-void Thread::Receive(int* sender_tid, int* type, uint64_t* payload) {
-  if (notified_) {
-    notified_ = false;
-    *sender_tid = 0;
-    *type = 0;
-    *payload = 0;
+void Thread::Receive(uint64_t timeout_ns, int from_tid, int type) {
+  bool filtered = from_tid || type != kAnyType;
+  if (notifications_ && !filtered) {
+    DeliverNotifications();
     return;
   }
 
-  if (send_queue_.IsEmpty()) {
-    receive_info_.sender_tid = sender_tid;
-    receive_info_.type = type;
-    receive_info_.payload = payload;
+  Thread* sender = nullptr;
+  for (Thread& queued : send_queue_) {
+    if (Matches(queued.id(), queued.state_.rsi, from_tid, type)) {
+      sender = &queued;
+      break;
+    }
+  }
+
+  if (!sender) {
+    if (timeout_ns == 0) {
+      SetReturnValue(uint64_t(kWouldBlock));
+      return;
+    }
+    if (timeout_ns != kNoTimeout &&
+        !g_scheduler->AddTimeout(this, g_clock->Deadline(timeout_ns))) {
+      SetReturnValue(uint64_t(kTooManyTimeouts));
+      return;
+    }
 
+    receive_from_ = from_tid;
+    receive_type_ = type;
     status_ = kBlockedReceiving;
     g_scheduler->Reschedule(false);
   } else {
-    Thread* sender = send_queue_.PopFront();
     assert_eq(sender->status_, kBlockedSending);
-    sender->status_ = kRunnable;
+    sender->StopWaiting();
+    DeliverMessage(sender);
+
+    // A caller goes straight on to wait for our reply, and keeps lending us
+    // its priority.
+    if (sender->receive_from_ == id()) {
+      sender->WaitOn(this, /*for_reply=*/ true);
+      sender->status_ = kBlockedReceiving;
+    } else {
+      sender->Wake();
+    }
+  }
+}
+
+void Thread::Call(int dest_tid, uint64_t timeout_ns) {
+  Trace(kTraceSend, id(), dest_tid);
+  Thread* dest = g_scheduler->FindThread(dest_tid);
+  if (!dest) {
+    SetReturnValue(uint64_t(kNoSuchThread));
+    return;
+  }
+
+  if (timeout_ns == 0) {
+    SetReturnValue(uint64_t(kWouldBlock));
+    return;
+  }
+
+  if (timeout_ns != kNoTimeout &&
+      !g_scheduler->AddTimeout(this, g_clock->Deadline(timeout_ns))) {
+    SetReturnValue(uint64_t(kTooManyTimeouts));
+    return;
+  }
+
+  receive_from_ = dest_tid;
+
+  if (dest->Accepts(this)) {
+    // Direct switch: we block until the reply, so neither of us goes through
+    // the run queues.
+    dest->DeliverMessage(this);
+    WaitOn(dest, /*for_reply=*/ true);
+    status_ = kBlockedReceiving;
+    g_scheduler->RunThread(dest, false);
+  } else {
+    // The reply is collected once the server receives the request. See Receive.
+    WaitOn(dest, /*for_reply=*/ false);
+    status_ = kBlockedSending;
+    g_scheduler->Reschedule(false);
+  }
+}
 
-    const SendInfo& info = sender->send_info_;
-    *sender_tid = info.sender_tid;
-    *type = info.type;
-    *payload = info.payload;
+void Thread::ReplyWait(int reply_tid) {
+  Thread* client = g_scheduler->FindThread(reply_tid);
 
-    g_scheduler->Enqueue(sender);
+  // Replies never block. If the client isn't waiting for one, or is gone,
+  // it's dropped.
+  if (client && client->Accepts(this)) {
+    client->DeliverMessage(this);
+
+    if (!notifications_ && send_queue_.IsEmpty()) {
+      // Direct switch: we would block in Receive anyway.
+      status_ = kBlockedReceiving;
+      g_scheduler->RunThread(client, false);
+      return;
+    }
+
+    // More work is waiting, so keep running and let the client queue up.
+    client->Wake();
   }
+
+  Receive();
 }
 
-void Thread::Notify(int notify_tid) {
+void Thread::Notify(int notify_tid, uint64_t bits, bool run_now) {
   Thread* dest = g_scheduler->FindThread(notify_tid);
-  // FIXME: Check for null dest.
-  if (dest->status_ == kBlockedReceiving) {
-    g_scheduler->RunThread(dest, true);
+  if (!dest || !bits) return;
 
-    // This must happen *after* RunThread so we're in the AS of the recipient.
-    // Warning: This is writing directly into the userspace. Could get page faults
-    // and maybe other exceptions? Need to handle this!
-    ReceiveInfo& info = dest->receive_info_;
-    *info.sender_tid = 0;
-    *info.type = 0;
-    *info.payload = 0;
-  } else {
-    dest->notified_ = true;
+  dest->notifications_ |= bits;
+  if (dest->Accepts(nullptr)) {
+    dest->DeliverNotifications();
+    if (run_now) {
+      g_scheduler->RunThread(dest, true);
+    } else {
+      dest->Wake();
+    }
   }
 }
 
-void Thread::NotifyFromKernel() {
-  if (status_ == kBlockedReceiving) {
+int Thread::TrySend(int dest_tid, uint64_t tag, const uint64_t* words) {
+  Trace(kTraceSend, id(), dest_tid);
+  Thread* dest = g_scheduler->FindThread(dest_tid);
+  if (!dest) {
+    return kNoSuchThread;
+  }
+
+  tag &= ~(kLongMessage | kSharedPages);
+  if (!dest->Accepts(id(), tag)) {
+    return kWouldBlock;
+  }
+
+  stats_.messages_sent++;
+  dest->stats_.messages_received++;
+  dest->DeliverWords(id(), tag, words);
+  dest->Wake();
+  return 0;
+}
+
+void Thread::NotifyFromKernel(uint64_t bits) {
+  notifications_ |= bits;
+  if (Accepts(nullptr)) {
+    DeliverNotifications();
     g_scheduler->RunThread(this, true);
+  }
+}
+
+// Weights of the fair priorities, from kFairPriority on. Each step down
+// gets about a fifth less CPU time than the one above.
+static const uint64_t kFairWeights[] = {
+  1024, 820, 655, 524, 419, 335, 268, 215, 172, 137, 110, 88, 70, 56, 45,
+};
+static_assert(sizeof(kFairWeights) / sizeof(kFairWeights[0]) ==
+              RunQueue::kNumPriorities - 1 - RunQueue::kFairPriority,
+              "One weight per fair priority");
+
+void RunQueue::Charge(Thread* thread, uint64_t ns) {
+  uint64_t weight = kFairWeights[thread->priority() - kFairPriority];
+  thread->vruntime_ += ns * kFairWeights[0] / weight;
+}
+
+void RunQueue::Enqueue(Thread* thread) {
+  int prio = thread->priority();
+  if (IsFair(prio)) {
+    if (thread->vruntime_ < min_vruntime_) {
+      thread->vruntime_ = min_vruntime_;
+    }
+    fair_.Push(thread);
+    prio = kFairPriority;
+  } else {
+    runnable_[prio].PushBack(thread->thread_links);
+  }
+  runnable_mask_ |= uint64_t(1) << prio;
+  size_++;
+}
+
+void RunQueue::Remove(Thread* thread) {
+  int prio = thread->priority();
+  bool empty;
+  if (IsFair(prio)) {
+    fair_.Remove(thread);
+    empty = fair_.IsEmpty();
+    prio = kFairPriority;
+  } else {
+    thread->thread_links.Remove();
+    empty = runnable_[prio].IsEmpty();
+  }
+  if (empty) {
+    runnable_mask_ &= ~(uint64_t(1) << prio);
+  }
+  size_--;
+}
+
+Thread* RunQueue::Dequeue(int max_priority) {
+  uint64_t mask = runnable_mask_ & PriorityMask(max_priority);
+  if (!mask) return nullptr;
 
-    // This must happen *after* RunThread so we're in the AS of the recipient.
-    // Warning: This is writing directly into the userspace. Could get page faults
-    // and maybe other exceptions? Need to handle this!
-    ReceiveInfo& info = receive_info_;
-    *info.sender_tid = 0;
-    *info.type = 0;
-    *info.payload = 0;
+  // Compiles to a single bsf.
+  int prio = __builtin_ctzll(mask);
+  Thread* thread;
+  bool empty;
+  if (prio == kFairPriority) {
+    thread = fair_.Pop();
+    empty = fair_.IsEmpty();
+    if (thread->vruntime_ > min_vruntime_) {
+      min_vruntime_ = thread->vruntime_;
+    }
   } else {
-    notified_ = true;
+    thread = runnable_[prio].PopFront();
+    empty = runnable_[prio].IsEmpty();
+  }
+  if (empty) {
+    runnable_mask_ &= ~(uint64_t(1) << prio);
+  }
+  size_--;
+  return thread;
+}
+
+void RunQueue::AdoptVruntime(Thread* thread) {
+  if (IsFair(thread->priority())) {
+    thread->vruntime_ += min_vruntime_;
   }
 }
 
-Scheduler::Scheduler(virt_addr_t syscall_stack_reservation)
-  : thread_id_hash_{} {
-  assert_eq((syscall_stack_reservation + sizeof(CpuState)) % kPageSize, 0);
-  cpu_state_ = reinterpret_cast<CpuState*>(syscall_stack_reservation);
-  *cpu_state_ = {};
+bool RunQueue::HasRunnable(int priority) const {
+  return runnable_mask_ & PriorityMask(priority);
+}
+
+Scheduler::Scheduler() {
+  // Interactive drivers get short slices so they can't hog the CPU. Background
+  // and batch work gets longer ones to cut down on switches.
+  for (int i = 0; i < kNumPriorities; i++) {
+    if (i < kDefaultPriority) {
+      quantum_[i] = 5;
+    } else if (i < kIdlePriority) {
+      quantum_[i] = 10;
+    } else {
+      quantum_[i] = 20;
+    }
+  }
+}
+
+void Scheduler::InitCpu(Cpu* cpu, Thread* idle_thread) {
+  int index = cpu->index();
+  assert_lt(index, kMaxCpus);
+  assert_eq(cpus_[index].cpu, nullptr);
+
+  PerCpu& per_cpu = cpus_[index];
+  per_cpu.cpu = cpu;
+  per_cpu.cpu_state = cpu->cpu_state();
+  *per_cpu.cpu_state = {};
+  per_cpu.idle_thread = idle_thread;
+
+  if (index >= num_cpus_) {
+    num_cpus_ = index + 1;
+  }
+
+  idle_thread->cpu_ = index;
+  idle_thread->pinned_ = true;
+  if (!idle_thread->Start()) {
+    panic("Out of thread IDs");
+  }
+}
+
+Scheduler::PerCpu& Scheduler::Current() {
+  return cpus_[CurrentCpu()->index()];
+}
+
+const Scheduler::PerCpu& Scheduler::Current() const {
+  return cpus_[CurrentCpu()->index()];
+}
+
+Thread* Scheduler::current_thread() const {
+  return Current().running_thread;
+}
+
+void Scheduler::PlaceThread(Thread* thread) {
+  if (thread->pinned_) return;
+
+  // Spread new threads round-robin over the CPUs that are up.
+  do {
+    thread->cpu_ = next_cpu_;
+    next_cpu_ = (next_cpu_ + 1) % num_cpus_;
+  } while (!cpus_[thread->cpu_].cpu);
 }
 
 void Scheduler::Enqueue(Thread* thread) {
-  int prio = thread->priority();
-  runnable_[prio].PushBack(thread->thread_links);
+  CancelTimeout(thread);
+  thread->runnable_since_ = g_clock->Now();
+  Trace(kTraceWake, thread->id(), thread->cpu_);
+
+  PerCpu& target = cpus_[thread->cpu_];
+  target.run_queue.Enqueue(thread);
+
+  // An idle CPU sits in hlt until its next tick. Kick it so it picks up the
+  // thread right away.
+  if (&target != &Current() && target.running_thread == target.idle_thread && g_local_apic) {
+    g_local_apic->SendIpi(target.cpu->apic_id(), LocalApic::kRescheduleVector);
+  }
 }
 
-Thread* Scheduler::Dequeue() {
-  for (int i = 0; i < kNumQueues; i++) {
-    if (runnable_[i].IsEmpty()) continue;
-    return runnable_[i].PopFront();
+void Scheduler::ShootDownTlb(const AddressSpace* address_space) {
+  PerCpu& current = Current();
+  Cpu* targets[kMaxCpus];
+  int num_targets = 0;
+  for (int i = 0; i < num_cpus_; i++) {
+    PerCpu& cpu = cpus_[i];
+    if (&cpu == &current || !cpu.running_thread ||
+        cpu.running_thread->address_space() != address_space) {
+      continue;
+    }
+
+    cpu.cpu->RequestTlbFlush();
+    g_local_apic->SendIpi(cpu.cpu->apic_id(), LocalApic::kTlbShootdownVector);
+    targets[num_targets++] = cpu.cpu;
   }
 
-  return nullptr;
+  // The interrupt gets them off user code and into waiting for the kernel
+  // lock, which is where they flush. One already in the kernel is waiting
+  // there as well, since we hold the lock.
+  for (int i = 0; i < num_targets; i++) {
+    while (targets[i]->tlb_flush_pending()) {
+      asm volatile("pause");
+    }
+  }
 }
 
-Allocator<Thread>* g_thread_allocator;
-DEFINE_ALLOCATION_METHODS(Thread, g_thread_allocator);
+int Scheduler::Load(const PerCpu& cpu) const {
+  int load = cpu.run_queue.size();
+  if (cpu.idle_thread && cpu.idle_thread->status_ == Thread::kRunnable) {
+    load--;
+  }
+  if (cpu.running_thread && cpu.running_thread != cpu.idle_thread) {
+    load++;
+  }
+  return load;
+}
 
-extern "C" {
-void SwitchAddressSpace(phys_addr_t tables);
-void SchedulerStart(ThreadState* state);
+Scheduler::PerCpu* Scheduler::FindBusiest(const PerCpu& current) {
+  PerCpu* busiest = nullptr;
+  int busiest_load = 0;
+  for (int i = 0; i < num_cpus_; i++) {
+    PerCpu& cpu = cpus_[i];
+    if (!cpu.cpu || &cpu == &current) continue;
+
+    int load = Load(cpu);
+    if (load > busiest_load) {
+      busiest = &cpu;
+      busiest_load = load;
+    }
+  }
+  return busiest;
+}
+
+bool Scheduler::IsCacheHot(const Thread* thread) const {
+  return cpus_[thread->cpu_].stats.ticks - thread->last_ran_tick_ < kCacheHotTicks;
+}
+
+Thread* Scheduler::Steal(PerCpu& current) {
+  PerCpu* busiest = FindBusiest(current);
+
+  // A CPU with a single thread has nothing waiting.
+  if (!busiest || Load(*busiest) < 2) return nullptr;
+
+  // Idle time is worse than a cold cache, so cache-hot threads are fair game.
+  Thread* thread = busiest->run_queue.StealTail([](Thread* t) {
+    return !t->pinned_;
+  });
+  if (thread) {
+    current.run_queue.AdoptVruntime(thread);
+    current.stats.steals++;
+  }
+  return thread;
+}
+
+void Scheduler::Rebalance(PerCpu& current) {
+  PerCpu* busiest = FindBusiest(current);
+  if (!busiest || Load(*busiest) - Load(current) < 2) return;
+
+  // StealTail tries the most urgent priorities first, so urgent work is
+  // spread out before background work.
+  Thread* thread = busiest->run_queue.StealTail([this](Thread* t) {
+    return !t->pinned_ && !IsCacheHot(t);
+  });
+  if (!thread) return;
+
+  thread->cpu_ = current.cpu->index();
+  current.stats.migrations++;
+  current.run_queue.AdoptVruntime(thread);
+  current.run_queue.Enqueue(thread);
+}
+
+void Scheduler::KickIdleCpu(const PerCpu& current) {
+  if (!g_local_apic || Load(current) < 2) return;
+
+  for (int i = 0; i < num_cpus_; i++) {
+    const PerCpu& cpu = cpus_[i];
+    if (!cpu.cpu || &cpu == &current) continue;
+
+    if (cpu.running_thread == cpu.idle_thread && !cpu.run_queue.HasRunnable(kIdlePriority - 1)) {
+      g_local_apic->SendIpi(cpu.cpu->apic_id(), LocalApic::kRescheduleVector);
+      return;
+    }
+  }
+}
+
+bool Scheduler::AddTimeout(Thread* thread, uint64_t deadline) {
+  PerCpu& current = Current();
+  assert_eq(thread, current.running_thread);
+  if (current.timeouts.IsFull()) {
+    return false;
+  }
+
+  thread->deadline_ = deadline;
+  current.timeouts.Push(thread);
+  return true;
+}
+
+void Scheduler::CancelTimeout(Thread* thread) {
+  if (decltype(PerCpu::timeouts)::Contains(thread)) {
+    cpus_[thread->cpu_].timeouts.Remove(thread);
+  }
+}
+
+void Scheduler::ProgramTimer(PerCpu& current) {
+  uint64_t deadline = current.next_tick;
+  if (!current.timeouts.IsEmpty()) {
+    uint64_t timeout = current.timeouts.Top()->deadline_;
+    if (!deadline || timeout < deadline) {
+      deadline = timeout;
+    }
+  }
+
+  if (deadline == current.timer_deadline) return;
+  current.timer_deadline = deadline;
+
+  if (!deadline) {
+    g_timer->Stop();
+    return;
+  }
+
+  uint64_t now = g_clock->Now();
+  g_timer->SetOneShot(deadline > now ? deadline - now : 0);
 }
 
+Allocator<Thread>* g_thread_allocator;
+DEFINE_ALLOCATION_METHODS(Thread, g_thread_allocator);
+
 void Scheduler::RunThread(Thread* thread, bool requeue) {
-  if (running_thread_) {
-    cpu_state_->previous_thread = &running_thread_->state_;
+  PerCpu& current = Current();
+  Thread* previous = current.running_thread;
+  uint64_t now = g_clock->Now();
+
+  CancelTimeout(thread);
+
+  // Another CPU may run the owner next, so its registers can't stay behind
+  // in ours.
+  if (current.fpu_enabled) {
+    SaveFpuState(current.fpu_owner->fpu_state_);
+    DisableFpu();
+    current.fpu_enabled = false;
+  }
+
+  if (previous) {
+    current.cpu_state->previous_thread = &previous->state_;
+    previous->last_ran_tick_ = current.stats.ticks;
+
+    if (previous != thread) {
+      previous->stats_.run_ns += now - previous->run_start_;
+      if (RunQueue::IsFair(previous->priority())) {
+        RunQueue::Charge(previous, now - previous->run_start_);
+      }
+      if (requeue) {
+        previous->stats_.involuntary_switches++;
+      } else {
+        previous->stats_.voluntary_switches++;
+      }
+    }
 
     if (requeue) {
-      running_thread_->status_ = Thread::kRunnable;
-      Enqueue(running_thread_);
+      previous->status_ = Thread::kRunnable;
+      previous->runnable_since_ = now;
+      current.run_queue.Enqueue(previous);
     }
 
-    running_thread_ = nullptr;
+    current.running_thread = nullptr;
   } else {
-    cpu_state_->previous_thread = nullptr;
+    current.cpu_state->previous_thread = nullptr;
   }
 
   //g_serial->Printf("Scheduling thread %p\n", (void*)thread->state_.rip);
 
-  running_thread_ = thread;
+  if (thread != previous) {
+    if (thread->runnable_since_) {
+      thread->stats_.wait_ns += now - thread->runnable_since_;
+    }
+    thread->run_start_ = now;
+  }
+  thread->runnable_since_ = 0;
+
+  Trace(kTraceSwitch, thread->id(), previous ? previous->id() : 0);
+  current.running_thread = thread;
   thread->status_ = Thread::kRunning;
+  thread->slice_remaining_ = quantum_[thread->priority()];
+  if (thread->cpu_ != current.cpu->index()) {
+    thread->cpu_ = current.cpu->index();
+    current.stats.migrations++;
+  }
+
+  if (previous && previous == current.idle_thread) {
+    current.stats.idle_ns += now - current.idle_start;
+  }
+  if (thread == current.idle_thread) {
+    current.idle_start = now;
+    current.next_tick = 0;
+  } else if (!current.next_tick) {
+    current.next_tick = now + kTickNs;
+  }
+  ProgramTimer(current);
 
-  cpu_state_->current_thread = &thread->state_;
+  current.cpu_state->current_thread = &thread->state_;
   SwitchAddressSpace(thread->address_space_->table_root());
 }
 
 void Scheduler::Reschedule(bool requeue) {
-  Thread* thread = Dequeue();
+  PerCpu& current = Current();
+
+  // Rather than go idle, take work from a busier CPU.
+  Thread* thread = current.run_queue.Dequeue(kIdlePriority - 1);
+  if (!thread) {
+    thread = Steal(current);
+  }
+  if (!thread) {
+    thread = current.run_queue.Dequeue();
+  }
   assert(thread);
 
   RunThread(thread, requeue);
 }
 
 void Scheduler::ExitThread() {
-  Thread* thread = running_thread_;
+  PerCpu& current = Current();
+  Thread* thread = current.running_thread;
+  assert(thread);
+
+  // Its registers go with it. RunThread would otherwise save them through
+  // fpu_owner, which RemoveThread clears.
+  if (current.fpu_enabled) {
+    DisableFpu();
+    current.fpu_enabled = false;
+  }
+
+  // Nothing may point at the thread once the work queue frees it.
+  thread->ReleaseWaiters();
+
+  // Nobody can find the thread from here on. The rest of it is freed later:
+  // we're still on its kernel stack, so it can only go once we've switched
+  // away from it.
+  RemoveThread(thread);
+
+  // FIXME: Would be good to have a general notification mechanism for when a thread exits.
+  g_interrupts->UnregisterForInterrupts(thread);
+
+  assert(!current.exited_thread);
+  current.exited_thread = thread;
+  Reschedule(/*requeue=*/ false);
+}
+
+void Scheduler::Block() {
+  Thread* thread = Current().running_thread;
+  thread->status_ = Thread::kBlockedInKernel;
+  Reschedule(/*requeue=*/ false);
+  SwitchKernelStacks();
+}
+
+void Scheduler::Unblock(Thread* thread) {
+  assert_eq(thread->status_, Thread::kBlockedInKernel);
+  thread->Wake();
+}
+
+void Scheduler::SwitchKernelStacks() {
+  PerCpu& current = Current();
+  Thread* from = current.stack_owner;
+  Thread* to = current.running_thread;
+  if (from == to) return;
+
+  current.stack_owner = to;
+  current.cpu->SetKernelStack(PhysicalToVirtual(to->kernel_stack_) + kPageSize);
+
+  // Nothing to come back to when starting up, or once the thread exited.
+  if (!from || from == current.exited_thread) {
+    ResumeKernelContext(to->kernel_rsp_);
+  }
+
+  SwitchKernelContext(&from->kernel_rsp_, to->kernel_rsp_);
+
+  // Back on the stack of |from|, which may run on another CPU by now.
+  FinishSwitch();
+}
+
+void Scheduler::FinishSwitch() {
+  PerCpu& current = Current();
+  if (current.exited_thread) {
+    Thread* thread = current.exited_thread;
+    g_work_queue->Defer(&thread->exit_work_, &DeleteThread, thread);
+    current.exited_thread = nullptr;
+  }
+}
+
+void Scheduler::HandleFpuTrap() {
+  PerCpu& current = Current();
+  Thread* thread = current.running_thread;
   assert(thread);
+  assert(!current.fpu_enabled);
+
+  EnableFpu();
+  if (!thread->fpu_state_) {
+    thread->fpu_state_ = new FpuState;
+    ResetFpuState(thread->fpu_state_);
+    RestoreFpuState(thread->fpu_state_);
+  } else if (current.fpu_owner != thread || thread->fpu_cpu_ != current.cpu->index()) {
+    RestoreFpuState(thread->fpu_state_);
+  }
+
+  current.fpu_owner = thread;
+  current.fpu_enabled = true;
+  thread->fpu_cpu_ = current.cpu->index();
+}
+
+void Scheduler::Tick() {
+  PerCpu& current = Current();
+  Thread* thread = current.running_thread;
+  if (!thread) return;
+
+  current.stats.ticks++;
+  if (current.stats.ticks % kBalanceIntervalTicks == 0) {
+    Rebalance(current);
+  }
+  KickIdleCpu(current);
+
+  if (thread->slice_remaining_ > 0) {
+    thread->slice_remaining_--;
+  }
+
+  if (thread->slice_remaining_ > 0) return;
+
+  // Keep running if nothing else of the same or higher priority is waiting.
+  if (!current.run_queue.HasRunnable(thread->priority())) {
+    thread->slice_remaining_ = quantum_[thread->priority()];
+    return;
+  }
+
+  Reschedule();
+}
+
+void Scheduler::CheckPreempt() {
+  PerCpu& current = Current();
+  Thread* thread = current.running_thread;
+  if (!thread || thread->priority() == 0) return;
+
+  // Fair threads only give way to strict priorities. Among themselves, they
+  // take turns at the end of their slices.
+  int max_priority = thread->priority() - 1;
+  if (RunQueue::IsFair(thread->priority())) {
+    max_priority = RunQueue::kFairPriority - 1;
+  }
+
+  Thread* next = current.run_queue.Dequeue(max_priority);
+  if (!next && thread == current.idle_thread) {
+    next = Steal(current);
+  }
+  if (!next) return;
+
+  RunThread(next);
+}
+
+void Scheduler::Sleep(uint64_t ns) {
+  Thread* thread = Current().running_thread;
+  if (!AddTimeout(thread, g_clock->Deadline(ns))) {
+    thread->SetReturnValue(uint64_t(Thread::kTooManyTimeouts));
+    return;
+  }
 
+  thread->SetReturnValue(0);
+  thread->status_ = Thread::kSleeping;
   Reschedule(/*requeue=*/ false);
+}
+
+void Scheduler::TimerInterrupt() {
+  PerCpu& current = Current();
+  current.timer_deadline = 0;
+  uint64_t now = g_clock->Now();
+
+  while (!current.timeouts.IsEmpty() && current.timeouts.Top()->deadline_ <= now) {
+    Thread* thread = current.timeouts.Pop();
+
+    // Take the message back out of the receiver's send queue, or stop
+    // waiting for the reply.
+    if (thread->waiting_on_) {
+      thread->StopWaiting();
+    }
+    if (thread->status_ == Thread::kBlockedSending ||
+        thread->status_ == Thread::kBlockedReceiving) {
+      thread->SetReturnValue(uint64_t(Thread::kTimedOut));
+      thread->receive_from_ = 0;
+      thread->receive_type_ = Thread::kAnyType;
+    } else if (thread->status_ == Thread::kBlockedFutex) {
+      thread->thread_links.Remove();
+      thread->SetReturnValue(uint64_t(Thread::kTimedOut));
+    }
+    thread->status_ = Thread::kRunnable;
+    Enqueue(thread);
+  }
+
+  if (current.next_tick && now >= current.next_tick) {
+    current.next_tick = now + kTickNs;
+    Tick();
+  }
+
+  // One of the threads that woke up may be more urgent than the running one.
+  CheckPreempt();
+
+  ProgramTimer(current);
+}
+
+void Scheduler::SetQuantum(int priority, int ticks) {
+  assert_ge(priority, 0);
+  assert_lt(priority, kNumPriorities);
+  assert_gt(ticks, 0);
+  quantum_[priority] = ticks;
+}
+
+bool Scheduler::SetPriority(Thread* thread, int priority) {
+  assert_ge(priority, 0);
+  assert_lt(priority, kNumPriorities);
+
+  // Threads are counted once they start.
+  bool was_fair = RunQueue::IsFair(thread->base_priority_);
+  bool fair = RunQueue::IsFair(priority);
+  if (thread->status_ != Thread::kStarting && fair != was_fair) {
+    if (fair) {
+      if (num_fair_threads_ == RunQueue::kMaxFairThreads) return false;
+      num_fair_threads_++;
+    } else {
+      num_fair_threads_--;
+    }
+  }
+
+  thread->base_priority_ = priority;
+  UpdateInheritedPriority(thread);
+
+  // A running thread that lowered itself below a waiting thread gives way.
+  if (thread == current_thread()) {
+    CheckPreempt();
+  }
+  return true;
+}
+
+void Scheduler::UpdateInheritedPriority(Thread* thread) {
+  // A server that is itself waiting on another server passes its priority
+  // on. The depth limit keeps a cycle of callers from looping forever.
+  for (int depth = 0; thread && depth < kMaxInheritanceDepth; depth++) {
+    // The send queue is in priority order, so its front is the most urgent
+    // sender.
+    int priority = thread->base_priority_;
+    if (!thread->send_queue_.IsEmpty() && thread->send_queue_.begin()->priority_ < priority) {
+      priority = thread->send_queue_.begin()->priority_;
+    }
+    for (Thread& waiter : thread->reply_waiters_) {
+      if (waiter.priority_ < priority) priority = waiter.priority_;
+    }
+
+    if (priority == thread->priority_) return;
+    ApplyPriority(thread, priority);
+    thread = thread->waiting_on_;
+  }
+}
+
+void Scheduler::ApplyPriority(Thread* thread, int priority) {
+  if (thread->status_ == Thread::kRunnable) {
+    RunQueue& queue = cpus_[thread->cpu_].run_queue;
+    queue.Remove(thread);
+    thread->priority_ = priority;
+    queue.Enqueue(thread);
+  } else if (thread->status_ == Thread::kBlockedSending) {
+    // Move to the new place in the send queue.
+    thread->thread_links.Remove();
+    thread->priority_ = priority;
+    thread->waiting_on_->QueueSender(thread);
+  } else {
+    thread->priority_ = priority;
+  }
+}
+
+void Scheduler::YieldToPriority(int priority) {
+  assert_ge(priority, 0);
+  assert_lt(priority, kNumPriorities);
 
-  delete thread;
+  Thread* thread = Current().run_queue.Dequeue(priority);
+  if (!thread) return;
+
+  RunThread(thread);
 }
 
 void Scheduler::Start() {
   Reschedule();
-  SchedulerStart(&running_thread_->state_);
+
+  // Leaves the boot stack behind for good.
+  SwitchKernelStacks();
+  panic("Scheduler::Start returned");
 }
 
 void Scheduler::DumpState() {
-  Thread* thread = running_thread_;
-  g_serial->Printf("tid = %d; rip = %p\n", thread->id(), (void*)thread->state_.rip);
+  Thread* thread = current_thread();
+  g_serial->Printf("cpu = %d; tid = %d; rip = %p\n",
+                   CurrentCpu()->index(), thread->id(), (void*)thread->state_.rip);
+  DumpStats();
 }
 
-void Scheduler::AddThread(Thread* thread) {
-  assert_ge(thread->id(), 0);
-  int h = thread->id() % kThreadIdHashSize;
-  thread->next_by_id_ = thread_id_hash_[h];
-  thread_id_hash_[h] = thread;
-}
+int Scheduler::CopyThreadStats(Thread* caller, virt_addr_t records, int max_records) {
+  uint64_t now = g_clock->Now();
+  int count = 0;
+  bool fault = false;
+  thread_ids_.ForEach([&](Thread* thread) {
+    if (count < max_records && !fault) {
+      ThreadStatsRecord record;
+      record.tid = thread->id();
+      record.priority = thread->priority();
+      record.cpu = thread->cpu_;
+      record.status = thread->status_;
+      record.stats = thread->stats_;
 
-void Scheduler::RemoveThread(Thread* thread) {
-  assert_ge(thread->id(), 0);
-  int h = thread->id() % kThreadIdHashSize;
-  for (Thread** t = &thread_id_hash_[h]; *t; t = &(*t)->next_by_id_) {
-    if (*t == thread) {
-      *t = thread->next_by_id_;
-      return;
+      if (thread->status_ == Thread::kRunning) {
+        record.stats.run_ns += now - thread->run_start_;
+      }
+
+      virt_addr_t to = records + count * sizeof(record);
+      fault = !caller->address_space()->CopyOut(to, &record, sizeof(record));
     }
+    count++;
+  });
+  return fault ? -1 : count;
+}
+
+void Scheduler::DumpStats() {
+  for (int i = 0; i < num_cpus_; i++) {
+    const PerCpu& cpu = cpus_[i];
+    if (!cpu.cpu) continue;
+
+    g_serial->Printf("cpu %d: load = %d; ticks = %u; idle = %u ms; steals = %u; migrations = %u\n",
+                     i, Load(cpu), unsigned(cpu.stats.ticks), unsigned(cpu.stats.idle_ns / 1000000),
+                     unsigned(cpu.stats.steals), unsigned(cpu.stats.migrations));
+  }
+}
+
+bool Scheduler::AddThread(Thread* thread) {
+  bool fair = RunQueue::IsFair(thread->base_priority_);
+  if (fair && num_fair_threads_ == RunQueue::kMaxFairThreads) {
+    return false;
+  }
+
+  if (thread->id_) {
+    if (!thread_ids_.AddFixed(thread->id_, thread)) return false;
+  } else {
+    thread->id_ = thread_ids_.Add(thread);
+    if (!thread->id_) return false;
   }
 
-  panic("Thread not found in hash table");
+  if (fair) {
+    num_fair_threads_++;
+  }
+  return true;
 }
 
-Thread* Scheduler::FindThread(int id) {
-  assert_ge(id, 0);
-  int h = id % kThreadIdHashSize;
-  for (Thread* t = thread_id_hash_[h]; t; t = t->next_by_id_) {
-    if (t->id() == id) {
-      return t;
+void Scheduler::RemoveThread(Thread* thread) {
+  for (int i = 0; i < num_cpus_; i++) {
+    if (cpus_[i].fpu_owner == thread) {
+      assert(!cpus_[i].fpu_enabled);
+      cpus_[i].fpu_owner = nullptr;
     }
   }
 
-  panic("Thread ID not found in hash table");
-  return nullptr;
+  thread_ids_.Remove(thread->id());
+  if (RunQueue::IsFair(thread->base_priority_)) {
+    num_fair_threads_--;
+  }
+}
+
+Thread* Scheduler::FindThread(int id) {
+  return thread_ids_.Find(id);
 }
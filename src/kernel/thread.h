@@ -2,10 +2,15 @@
 #define thread_h
 
 #include "base/linked_list.h"
+#include "base/min_heap.h"
 #include "base/types.h"
 #include "kernel/address_space.h"
 #include "kernel/allocator.h"
+#include "kernel/cpu.h"
+#include "kernel/id_table.h"
+#include "kernel/work_queue.h"
 
+struct FpuState;
 class Scheduler;
 
 // Warning: Any changes to this structure must be reflected in interrupt_handlers.s:thread_state.
@@ -40,18 +45,53 @@ struct CpuState {
   ThreadState* previous_thread;
 };
 
-struct SendInfo {
-  int sender_tid;
-  int type;
-  uint64_t payload;
+// What a thread used so far. Times are in nanoseconds.
+struct ThreadStats {
+  uint64_t run_ns = 0;
+
+  // Time spent runnable, waiting for a CPU.
+  uint64_t wait_ns = 0;
+
+  // Switches away from the thread because it blocked or exited, and because
+  // something else took the CPU while it could have kept running.
+  uint64_t voluntary_switches = 0;
+  uint64_t involuntary_switches = 0;
+
+  // Messages delivered, not counting notifications.
+  uint64_t messages_sent = 0;
+  uint64_t messages_received = 0;
 };
 
-struct ReceiveInfo {
-  int* sender_tid;
-  int* type;
-  uint64_t* payload;
+// One thread in the result of SysGetThreadStats.
+// Warning: Any changes to this structure must be reflected in usr/system.h.
+struct ThreadStatsRecord {
+  int32_t tid;
+  int32_t priority;
+  int32_t cpu;
+  int32_t status;
+  ThreadStats stats;
 };
 
+// Messages travel in registers. The sender puts the tag (type in the low 32
+// bits, number of words in the high 32 bits) in rsi and the words in rdx,
+// r10, r8, r9, r12 and r13. The receiver gets the same registers back, with
+// the sender's thread ID, or 0 for a notification, in rax.
+static const int kMaxMessageWords = 6;
+
+static const int kMessageLengthShift = 32;
+static const uint64_t kMessageLengthMask = 0xffff;
+
+// Tag flag for a message that names a buffer in its first two words, address
+// and size. The receiver gets the address and size of its copy instead. See
+// Thread::DeliverLongMessage.
+static const uint64_t kLongMessage = uint64_t(1) << 63;
+
+// Set by the kernel on a long message whose pages were shared with the
+// receiver rather than copied to its receive buffer. A sender sets it to
+// have the pages shared whatever their size, or nothing delivered at all.
+// The receiver may only write to pages shared at the sender's request.
+static const uint64_t kSharedPages = uint64_t(1) << 62;
+
 class Thread {
 public:
   Thread(virt_addr_t start_func,
@@ -66,20 +106,86 @@ public:
   // Thread can call in/out instructions.
   void AllowIo();
 
-  void Start();
+  // Returns false, leaving the thread for the caller to delete, if it can't
+  // have an ID, because the table is full or the fixed one it was given is
+  // taken, or if there are too many threads with fair priorities.
+  bool Start();
 
+  // The ID is handed out by Start, unless the thread was given a fixed one
+  // before that (IdTable::kNumFixed).
   int id() const { return id_; }
   void set_id(int id) { id_ = id; }
+  // The priority the thread runs at. That's the most urgent of its own and
+  // those of the threads waiting for it in Send or Call.
   int priority() const { return priority_; }
 
-  void Send(int dest_tid, int type, uint64_t payload);
-  void Receive(int* sender_tid, int* type, uint64_t* payload);
-  void Notify(int notify_tid);
-  void NotifyFromKernel();
+  // The IPC calls take the message from the thread's saved registers and
+  // leave the received one there.
+  //
+  // With a timeout, they return kTimedOut in the thread's rax if it passes
+  // first. A timeout of 0 polls: if the call would have to wait, it returns
+  // kWouldBlock right away instead. If the CPU can't take another timeout,
+  // they return kTooManyTimeouts without waiting.
+
+  // Returns 0 once the message is delivered.
+  void Send(int dest_tid, uint64_t timeout_ns = kNoTimeout);
+
+  // Takes the most urgent message, in priority order of the senders and
+  // first come, first served within a priority. If |from_tid| is not 0, only
+  // messages from that thread are taken, and if |type| is not kAnyType, only
+  // messages of that type. Notifications wait for a receive without either.
+  void Receive(uint64_t timeout_ns = kNoTimeout, int from_tid = 0, int type = kAnyType);
+
+  // Sends a request and waits for the reply from |dest_tid| in one step. The
+  // timeout covers both. A Call always waits, so it can't poll.
+  void Call(int dest_tid, uint64_t timeout_ns = kNoTimeout);
+
+  // Replies to a thread waiting in Call, then receives the next message. The
+  // reply is dropped if |reply_tid| isn't waiting for one from us.
+  void ReplyWait(int reply_tid);
+
+  // Sets |bits| in the notification word of a thread. The next Receive of
+  // the thread returns the whole word and clears it, so notifications that
+  // come in before then coalesce into one.
+  //
+  // Unless |run_now| is false, a receiver that takes the notification runs
+  // right away, in our place.
+  void Notify(int notify_tid, uint64_t bits, bool run_now = true);
+  void NotifyFromKernel(uint64_t bits);
+
+  // Like Send with a timeout of 0, but the message comes from |tag| and
+  // |words| instead of our registers, and a receiver that takes it goes on a
+  // run queue rather than running in our place, so we keep running. For
+  // system call batches. Long messages aren't supported.
+  int TrySend(int dest_tid, uint64_t tag, const uint64_t* words);
+
+  // Where long messages sent to the thread are copied.
+  void SetReceiveBuffer(virt_addr_t buffer, size_t size);
+
+  AddressSpace* address_space() const { return address_space_.value(); }
+
+  // Sets what the system call the thread is in returns to user space.
+  void SetReturnValue(uint64_t value) { state_.rax = value; }
+
+  // The message fills the argument registers, so timed IPC system calls
+  // take the timeout in r14.
+  uint64_t ipc_timeout() const { return state_.r14; }
+
+  static const uint64_t kNoTimeout = UINT64_MAX;
+  static const int kTimedOut = -1;
+  static const int kWouldBlock = -2;
+  static const int kNoSuchThread = -4;
+  static const int kTooManyTimeouts = -5;
+  static const int kAnyType = -1;
+
+  // Long messages at least this big are shared instead of copied.
+  static const size_t kShareThreshold = 16 * 1024;
 
   DECLARE_ALLOCATION_METHODS();
 
 private:
+  friend class FutexTable;
+  friend class RunQueue;
   friend class Scheduler;
 
   enum Status {
@@ -87,71 +193,479 @@ private:
     kRunnable,
     kRunning,
     kBlockedReceiving,
-    kBlockedSending
+    kBlockedSending,
+    kBlockedFutex,
+    kBlockedInKernel,
+    kSleeping
   };
 
+  // Returns true if the thread is blocked in Receive or Call and takes a
+  // message from |sender|, or a notification if |sender| is null.
+  bool Accepts(const Thread* sender) const;
+  bool Accepts(int sender_id, uint64_t tag) const;
+
+  // Returns true if a message from |sender_id| with |tag| passes a Receive
+  // filter.
+  static bool Matches(int sender_id, uint64_t tag, int from_tid, int type);
+
+  // Puts |sender| on our send queue, behind the senders of the same or a
+  // more urgent priority.
+  void QueueSender(Thread* sender);
+
+  // Copies the message in the registers of |sender| to ours.
+  void DeliverMessage(Thread* sender);
+
+  // Puts a short message from |sender_id| in our registers.
+  void DeliverWords(int sender_id, uint64_t tag, const uint64_t* words);
+
+  // Makes a blocked thread that got its message runnable, on a run queue
+  // rather than right away.
+  void Wake();
+
+  // Queues us on |server| for it to receive our message, or to reply to our
+  // Call, and lends it our priority in the meantime.
+  void WaitOn(Thread* server, bool for_reply);
+  void StopWaiting();
+
+  // Fails the Send or Call of every thread waiting on us with kNoSuchThread,
+  // for when we exit.
+  void ReleaseWaiters();
+
+  // Hands the pending notification bits to us as a message from thread 0,
+  // with the bits in the first word, and clears them.
+  void DeliverNotifications();
+
+  // Copies the buffer of a long message from |sender| to our receive buffer,
+  // or maps its pages into our address space if it is at least
+  // kShareThreshold bytes or the sender asked for that, and it starts on a
+  // page boundary. Either way, it gets there without a trip through a kernel
+  // buffer.
+  void DeliverLongMessage(const Thread* sender);
+
   // Must be the first member!
   LinkedListEntry thread_links;
 
-  int id_;
+  int id_ = 0;
+
+  // The user registers, saved on every entry to the kernel.
   ThreadState state_;
+
+  // Every thread has a kernel stack of its own, one page. A thread that
+  // stops running while in the kernel keeps its place on it: kernel_rsp_ is
+  // where its stack pointer was. See Scheduler::SwitchKernelStacks.
+  phys_addr_t kernel_stack_;
+  uint64_t kernel_rsp_;
   RefPtr<AddressSpace> address_space_;
   int priority_;
+  int base_priority_;
   Status status_ = kStarting;
   LinkedList<Thread, 0> send_queue_;
 
-  // The next link for the thread ID hashtable.
-  Thread* next_by_id_ = nullptr;
+  // Callers whose requests we received, until we reply.
+  LinkedList<Thread, 0> reply_waiters_;
+
+  // The thread whose send_queue_ or reply_waiters_ we are on.
+  Thread* waiting_on_ = nullptr;
+
+  // Ticks left before the thread is preempted.
+  int slice_remaining_ = 0;
+
+  // Index of the CPU whose run queue the thread goes on. Pinned threads never
+  // move to another CPU.
+  int cpu_ = 0;
+  bool pinned_ = false;
+
+  // Cache affinity hint: the tick count of cpu_ when the thread last stopped
+  // running there. The balancer leaves recently run threads where they are.
+  uint64_t last_ran_tick_ = 0;
+
+  // When a sleeping thread or a receive with a timeout wakes up, in
+  // Clock::Now() time. Only meaningful while deadline_index_ >= 0, which
+  // means the thread is in the timeout queue of cpu_.
+  uint64_t deadline_ = 0;
+  int deadline_index_ = -1;
 
   // For IPC.
-  SendInfo send_info_;
-  ReceiveInfo receive_info_;
-  bool notified_ = false;
+  uint64_t notifications_ = 0;
+
+  // While in Call, the server we're waiting on. While in Receive, what the
+  // filter takes.
+  int receive_from_ = 0;
+  int receive_type_ = kAnyType;
+
+  virt_addr_t receive_buffer_ = 0;
+  size_t receive_buffer_size_ = 0;
+
+  // The physical address of the word we wait on in FutexTable::Wait.
+  phys_addr_t futex_key_ = 0;
+
+  // Where the FPU and vector registers go while the thread isn't using them,
+  // allocated on first use. fpu_cpu_ is the CPU whose registers last had
+  // them loaded, or -1. See Scheduler::HandleFpuTrap.
+  FpuState* fpu_state_ = nullptr;
+  int fpu_cpu_ = -1;
+
+  // Frees the thread once it exited.
+  DeferredWork exit_work_;
+
+  // Updated in Scheduler::RunThread. While running, the thread has been
+  // since run_start_; while on a run queue, since runnable_since_.
+  ThreadStats stats_;
+  uint64_t run_start_ = 0;
+  uint64_t runnable_since_ = 0;
+
+  // For fair priorities: CPU time used, scaled down by the weight of the
+  // priority, in nanoseconds. The position in RunQueue::fair_ goes with it.
+  uint64_t vruntime_ = 0;
+  int fair_index_ = -1;
 };
 
 extern Allocator<Thread>* g_thread_allocator;
 
+// The threads waiting to run on one CPU. Most priorities are strict, with
+// one FIFO queue each: a thread only runs when no more urgent one is
+// waiting, and threads of the same priority take turns.
+//
+// The priorities from kFairPriority up to the idle priority share the CPU
+// instead, for batch work. Together they rank below every strict priority
+// but the idle one. Among them, whichever thread has the least virtual
+// runtime goes next. Virtual runtime grows more slowly the more urgent the
+// priority is, so each thread gets CPU time in proportion to its weight
+// and none of them starves.
+class RunQueue {
+public:
+  // Priority 0 is the most urgent.
+  static const int kNumPriorities = 64;
+  static const int kFairPriority = 48;
+
+  static bool IsFair(int priority) {
+    return priority >= kFairPriority && priority < kNumPriorities - 1;
+  }
+
+  // Adds |ns| of running time to the virtual runtime of a thread with a fair
+  // priority.
+  static void Charge(Thread* thread, uint64_t ns);
+
+  void Enqueue(Thread* thread);
+  void Remove(Thread* thread);
+
+  // Returns the first thread of the most urgent non-empty queue, considering
+  // only priorities up to |max_priority|.
+  Thread* Dequeue(int max_priority = kNumPriorities - 1);
+
+  // Returns true if a thread of |priority| or a more urgent priority is waiting to run.
+  bool HasRunnable(int priority) const;
+
+  // Removes and returns the most recently queued thread of the most urgent
+  // priority for which |can_migrate(thread)| is true, or nullptr. A fair
+  // thread leaves with its virtual runtime relative to our min_vruntime_,
+  // for the queue it moves to to make its own with AdoptVruntime.
+  template <typename Predicate>
+  Thread* StealTail(Predicate can_migrate);
+
+  // Bases the virtual runtime of a thread StealTail took from another queue
+  // on our min_vruntime_. Every queue's clock runs at its own pace, so a
+  // thread would otherwise arrive far ahead of or behind the threads here.
+  void AdoptVruntime(Thread* thread);
+
+  int size() const { return size_; }
+
+  // Most threads with fair priorities waiting on one CPU at a time. The
+  // scheduler doesn't let more than that many exist at once.
+  static const int kMaxFairThreads = 1024;
+
+private:
+  struct VruntimeTraits {
+    static uint64_t Key(const Thread* thread) { return thread->vruntime_; }
+    static int& Index(Thread* thread) { return thread->fair_index_; }
+  };
+
+  static uint64_t PriorityMask(int max_priority) {
+    // Wraps around to all bits set for the least urgent priority.
+    return (uint64_t(2) << max_priority) - 1;
+  }
+
+  // Bit N is set when runnable_[N] is non-empty, except that bit
+  // kFairPriority stands for fair_, and the lists of the other fair
+  // priorities stay empty.
+  uint64_t runnable_mask_ = 0;
+  LINKED_LIST(Thread, thread_links) runnable_[kNumPriorities];
+  static_assert(kNumPriorities <= 64, "runnable_mask_ has one bit per priority");
+
+  // The waiting threads with fair priorities, least virtual runtime first.
+  MinHeap<Thread, VruntimeTraits, kMaxFairThreads> fair_;
+
+  // The virtual runtime of the last fair thread to leave the queue. Threads
+  // coming back after a sleep start no further back, so they can't claim the
+  // CPU for as long as they were away.
+  uint64_t min_vruntime_ = 0;
+
+  int size_ = 0;
+};
+
+template <typename Predicate>
+Thread* RunQueue::StealTail(Predicate can_migrate) {
+  for (uint64_t mask = runnable_mask_; mask; mask &= mask - 1) {
+    int prio = __builtin_ctzll(mask);
+
+    // The end of the heap array is as good as the tail.
+    if (prio == kFairPriority) {
+      for (size_t i = fair_.size(); i > 0; i--) {
+        Thread* thread = fair_.At(i - 1);
+        if (can_migrate(thread)) {
+          Remove(thread);
+          thread->vruntime_ -= min_vruntime_;
+          return thread;
+        }
+      }
+      continue;
+    }
+
+    // The tail is the thread that would run last, and the least likely to
+    // still have anything in the cache.
+    for (auto it = runnable_[prio].rbegin(); it; ++it) {
+      Thread* thread = &*it;
+      if (can_migrate(thread)) {
+        Remove(thread);
+        return thread;
+      }
+    }
+  }
+
+  return nullptr;
+}
+
 class Scheduler {
 public:
-  Scheduler(virt_addr_t syscall_stack_reservation);
+  Scheduler();
+
+  // Sets up the run queue of the calling CPU. |idle_thread| runs whenever
+  // nothing else is runnable there and never moves to another CPU.
+  void InitCpu(Cpu* cpu, Thread* idle_thread);
 
-  // Starts the scheduler and runs the highest priority thread.
+  // Starts scheduling on the calling CPU and runs its highest priority thread.
   void Start();
 
   // Schedules a different thread to run upon returning to user space.
   void RunThread(Thread* thread, bool requeue = true);
   void Reschedule(bool requeue = true);
 
+  // Returns nullptr if no thread has |id|, which may be one of a thread that
+  // exited.
   Thread* FindThread(int id);
 
   void ExitThread();
 
+  // Called once per tick while a thread other than the idle thread runs.
+  // Charges the tick to the running thread and preempts it once its time
+  // slice is used up.
+  void Tick();
+
+  // Called when another CPU put a thread on our run queue. Switches to it if
+  // it is more urgent than the running thread.
+  void CheckPreempt();
+
+  // Sets the length of the time slice, in ticks, given to threads of |priority|.
+  void SetQuantum(int priority, int ticks);
+
+  // Changes the priority of |thread|, moving it to the right run queue if
+  // needed. Threads waiting for it may still lift it above |priority|.
+  // Returns false, changing nothing, if |priority| is fair and there are
+  // RunQueue::kMaxFairThreads threads with fair priorities already.
+  bool SetPriority(Thread* thread, int priority);
+
+  // Gives up the CPU, but only to a thread of |priority| or a more urgent one.
+  // Returns without switching if there is none.
+  void YieldToPriority(int priority);
+
+  // Blocks the running thread in the middle of kernel code. Returns once
+  // Unblock was called on it and it gets to run again, with everything on its
+  // kernel stack as it was.
+  void Block();
+  void Unblock(Thread* thread);
+
+  // Called on the way out of the kernel. If the running thread isn't the one
+  // whose kernel stack we're on, parks that one and carries on where the
+  // running thread left off. Returns once the first is switched back to.
+  void SwitchKernelStacks();
+
+  // Finishes the switch on the stack we switched to.
+  void FinishSwitch();
+
+  // Handles the trap a thread takes on its first use of the FPU or vector
+  // registers since it was switched to: loads its state, unless the registers
+  // still hold it, and lets it carry on.
+  void HandleFpuTrap();
+
+  static const int kNumPriorities = RunQueue::kNumPriorities;
+  static const int kDriverPriority = 8;
+  static const int kDefaultPriority = 32;
+  static const int kIdlePriority = kNumPriorities - 1;
+
+  // Length of a timer tick.
+  static const uint64_t kTickNs = 1000000;
+
   // For debugging. Dumps to serial port.
   void DumpState();
+  void DumpStats();
+
+  // Copies a ThreadStatsRecord for each thread, up to |max_records| of them,
+  // to |records| in the address space of |caller|. Returns the number of
+  // threads, or -1 if |records| isn't writable.
+  int CopyThreadStats(Thread* caller, virt_addr_t records, int max_records);
 
-  Thread* current_thread() const { return running_thread_; }
+  Thread* current_thread() const;
 
-  // Amount of space to reserve at the top of the syscall stack for the scheduler.
-  static size_t SysCallStackAdjustment() { return sizeof(CpuState); }
+  // Makes every other CPU running a thread of |address_space| flush its TLB,
+  // and waits until they have. The rest reload CR3 before they run one.
+  void ShootDownTlb(const AddressSpace* address_space);
+
+  // Blocks the running thread for |ns| nanoseconds. Returns 0 in its rax
+  // then, or Thread::kTooManyTimeouts right away.
+  void Sleep(uint64_t ns);
+
+  // Called when the timer of the calling CPU fires. Wakes up threads whose
+  // timeouts expired and charges a tick to the running thread if one is due.
+  void TimerInterrupt();
+
+  // Counters for tuning the load balancer.
+  struct CpuStats {
+    // Ticks taken while running threads other than the idle thread.
+    uint64_t ticks = 0;
+
+    // Time spent running the idle thread, in nanoseconds.
+    uint64_t idle_ns = 0;
+
+    // Threads taken from another CPU's run queue while idle.
+    uint64_t steals = 0;
+
+    // Threads that started running here after last running on another CPU.
+    uint64_t migrations = 0;
+  };
+
+  const CpuStats& cpu_stats(int cpu) const { return cpus_[cpu].stats; }
+  int num_cpus() const { return num_cpus_; }
+
+  // Ticks between rebalancing passes on each CPU.
+  static const int kBalanceIntervalTicks = 20;
+
+  // Threads that ran on a CPU less than this many ticks ago are considered
+  // cache-hot there and are only moved by idle CPUs.
+  static const int kCacheHotTicks = 2;
 
 private:
+  friend class FutexTable;
   friend class Thread;
 
-  void AddThread(Thread* thread);
+  struct DeadlineTraits {
+    static uint64_t Key(const Thread* thread) { return thread->deadline_; }
+    static int& Index(Thread* thread) { return thread->deadline_index_; }
+  };
+
+  // Most threads that can wait with a timeout on one CPU at a time.
+  static const int kMaxTimeouts = 1024;
+
+  // Scheduling state of one CPU.
+  struct PerCpu {
+    Cpu* cpu = nullptr;
+    CpuState* cpu_state = nullptr;
+    Thread* running_thread = nullptr;
+    Thread* idle_thread = nullptr;
+
+    // The thread whose kernel stack the CPU is on. It differs from
+    // running_thread between RunThread and the switch on the way out.
+    Thread* stack_owner = nullptr;
+
+    // A thread that exited while on its own kernel stack. It goes to the work
+    // queue to be deleted once we're off it.
+    Thread* exited_thread = nullptr;
+    RunQueue run_queue;
+    CpuStats stats;
+
+    // Threads blocked with a timeout, by deadline.
+    MinHeap<Thread, DeadlineTraits, kMaxTimeouts> timeouts;
+
+    // When the next tick is due, or 0 while idle. Ticks only happen while
+    // there is a thread to preempt.
+    uint64_t next_tick = 0;
+
+    // What the timer is programmed for, or 0 if it is stopped.
+    uint64_t timer_deadline = 0;
+
+    // When the idle thread started running.
+    uint64_t idle_start = 0;
+
+    // The last thread whose FPU state was loaded on this CPU, and whether
+    // CR0.TS is clear so that it may be using the registers right now.
+    Thread* fpu_owner = nullptr;
+    bool fpu_enabled = false;
+  };
+
+  PerCpu& Current();
+  const PerCpu& Current() const;
+
+  // Gives |thread| its ID, or registers the fixed one it has, and counts it
+  // if its priority is fair. Returns false if it can't have either.
+  bool AddThread(Thread* thread);
   void RemoveThread(Thread* thread);
 
+  // Picks the CPU a newly started thread will run on.
+  void PlaceThread(Thread* thread);
+
+  // Puts |thread| on the run queue of the CPU it last ran on, waking that
+  // CPU up if it is idle.
   void Enqueue(Thread* thread);
-  Thread* Dequeue();
 
-  static const int kNumQueues = 3;
-  static const int kThreadIdHashSize = 16384;
+  // Number of threads running or waiting to run on |cpu|, not counting its
+  // idle thread.
+  int Load(const PerCpu& cpu) const;
+
+  // Returns the other CPU with the highest load, or nullptr if there is none.
+  PerCpu* FindBusiest(const PerCpu& current);
+
+  bool IsCacheHot(const Thread* thread) const;
+
+  // Takes a thread from the busiest other CPU for |current| to run now.
+  // Returns nullptr if there is nothing to take.
+  Thread* Steal(PerCpu& current);
+
+  // Pulls a thread over to |current| if another CPU has at least two more.
+  void Rebalance(PerCpu& current);
+
+  // Idle CPUs don't take ticks, so a busy CPU wakes one up to steal from it.
+  void KickIdleCpu(const PerCpu& current);
+
+  // Wakes up the running thread at |deadline| unless something else wakes
+  // it up first. It must block right after. Returns false, and the thread
+  // must not block, if the CPU has kMaxTimeouts pending already.
+  bool AddTimeout(Thread* thread, uint64_t deadline);
+  void CancelTimeout(Thread* thread);
+
+  // Recomputes the priority |thread| inherits from the threads waiting for
+  // it, and the same for whoever it is waiting for in turn.
+  void UpdateInheritedPriority(Thread* thread);
+
+  // Sets the priority |thread| runs at, without preempting anything.
+  void ApplyPriority(Thread* thread, int priority);
+
+  static const int kMaxInheritanceDepth = 8;
+
+  // Programs the timer of |current| for its next tick or timeout.
+  void ProgramTimer(PerCpu& current);
+
+  PerCpu cpus_[kMaxCpus];
+  int num_cpus_ = 0;
+  int next_cpu_ = 0;
 
-  CpuState* cpu_state_;
+  // Time slice per priority, in ticks.
+  int quantum_[kNumPriorities];
 
-  Thread* running_thread_ = nullptr;
-  LINKED_LIST(Thread, thread_links) runnable_[kNumQueues];
+  IdTable<Thread> thread_ids_;
 
-  Thread* thread_id_hash_[kThreadIdHashSize];
+  // Started threads whose own priority is fair. Inheriting a priority only
+  // ever makes a thread more urgent, so no run queue holds more fair
+  // threads than this.
+  int num_fair_threads_ = 0;
 };
 
 extern Scheduler* g_scheduler;
@@ -0,0 +1,106 @@
+#include "timer.h"
+
+#include "base/assertions.h"
+#include "kernel/apic.h"
+#include "kernel/interrupts.h"
+#include "kernel/serial.h"
+
+static const int kPitChannel0Port = 0x40;
+static const int kPitChannel2Port = 0x42;
+static const int kPitCommandPort = 0x43;
+static const int kPitGatePort = 0x61;
+
+static const int kPitIRQ = 0;
+
+static const uint64_t kNanosecondsPerSecond = 1000000000;
+
+Timer* g_timer;
+
+void PitTimer::SetOneShot(uint64_t delay_ns) {
+  // Saturates at about 55ms.
+  uint64_t count = delay_ns * kFrequency / kNanosecondsPerSecond;
+  if (count < 1) count = 1;
+  if (count > 0xffff) count = 0xffff;
+
+  // Channel 0, lobyte/hibyte access, mode 0 (interrupt on terminal count), binary.
+  io_->Out(kPitCommandPort, 0x30);
+  io_->Out(kPitChannel0Port, count & 0xff);
+  io_->Out(kPitChannel0Port, (count >> 8) & 0xff);
+
+  interrupts_->Mask(kPitIRQ, true);
+}
+
+void PitTimer::Stop() {
+  interrupts_->Mask(kPitIRQ, false);
+}
+
+bool PitTimer::HandleInterrupt(int interrupt_number) {
+  if (interrupts_->InterruptNumberToIRQ(interrupt_number) != kPitIRQ) return false;
+
+  interrupts_->Acknowledge(kPitIRQ);
+  return true;
+}
+
+void PitTimer::BusyWait(IoPorts* io, uint64_t us) {
+  // Channel 2 counts down from at most 0xffff, so wait in chunks.
+  while (us) {
+    uint64_t chunk = us > 50000 ? 50000 : us;
+    us -= chunk;
+
+    uint64_t count = kFrequency * chunk / 1000000;
+    if (count < 1) count = 1;
+
+    // Enable the channel 2 gate and disconnect the speaker.
+    int gate = (io->In(kPitGatePort) & ~0x2) | 0x1;
+    io->Out(kPitGatePort, gate);
+
+    // Channel 2, lobyte/hibyte access, mode 0 (interrupt on terminal count), binary.
+    io->Out(kPitCommandPort, 0xb0);
+    io->Out(kPitChannel2Port, count & 0xff);
+    io->Out(kPitChannel2Port, (count >> 8) & 0xff);
+
+    // Restart the count by pulsing the gate.
+    io->Out(kPitGatePort, gate & ~0x1);
+    io->Out(kPitGatePort, gate);
+
+    // Bit 5 reflects the output of channel 2, which goes high at terminal count.
+    while (!(io->In(kPitGatePort) & 0x20)) {}
+  }
+}
+
+void ApicTimer::Calibrate() {
+  const int kCalibrationMs = 10;
+
+  apic_->StartTimer(kVector, 0xffffffff, false);
+  PitTimer::BusyWait(io_, kCalibrationMs * 1000);
+  uint32_t elapsed = 0xffffffff - apic_->TimerCount();
+  apic_->StopTimer();
+
+  counts_per_ms_ = elapsed / kCalibrationMs;
+  LOG(INFO).Printf("APIC timer: %u counts per ms", unsigned(counts_per_ms_));
+  assert_gt(counts_per_ms_, 0);
+}
+
+void ApicTimer::SetOneShot(uint64_t delay_ns) {
+  if (!counts_per_ms_) {
+    Calibrate();
+  }
+
+  // Divide first; a long sleep would overflow otherwise.
+  uint64_t count = counts_per_ms_ * (delay_ns / 1000) / 1000;
+  if (count < 1) count = 1;
+  if (count > 0xffffffff) count = 0xffffffff;
+
+  apic_->StartTimer(kVector, count, false);
+}
+
+void ApicTimer::Stop() {
+  apic_->StopTimer();
+}
+
+bool ApicTimer::HandleInterrupt(int interrupt_number) {
+  if (interrupt_number != kVector) return false;
+
+  apic_->EndOfInterrupt();
+  return true;
+}
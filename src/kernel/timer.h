@@ -0,0 +1,73 @@
+#ifndef timer_h
+#define timer_h
+
+#include "base/io.h"
+#include "base/types.h"
+
+class InterruptController;
+class LocalApic;
+
+// A one-shot interrupt source. The scheduler programs it for the next thing
+// it has to do on the calling CPU: the end of the current tick, or the
+// earliest sleep or receive timeout. Idle CPUs with nothing pending don't get
+// interrupts at all.
+class Timer {
+public:
+  // Raises a single interrupt after about |delay_ns| nanoseconds, replacing
+  // the pending one. It may come early if the delay is out of range; the
+  // scheduler then programs the rest.
+  virtual void SetOneShot(uint64_t delay_ns) = 0;
+
+  // Cancels the pending interrupt, if any.
+  virtual void Stop() = 0;
+
+  // Returns true if |interrupt_number| came from this timer, after
+  // acknowledging it.
+  virtual bool HandleInterrupt(int interrupt_number) = 0;
+};
+
+// The legacy 8253/8254 programmable interval timer, wired to IRQ 0 of the PIC.
+// Only used on machines without a local APIC, so there is only one CPU.
+class PitTimer : public Timer {
+public:
+  PitTimer(IoPorts* io, InterruptController* interrupts) : io_(io), interrupts_(interrupts) {}
+
+  void SetOneShot(uint64_t delay_ns) override;
+  void Stop() override;
+  bool HandleInterrupt(int interrupt_number) override;
+
+  // Spins for |us| microseconds using channel 2, which doesn't raise interrupts.
+  // Usable before interrupts are set up.
+  static void BusyWait(IoPorts* io, uint64_t us);
+
+  static const uint64_t kFrequency = 1193182;
+
+private:
+  IoPorts* io_;
+  InterruptController* interrupts_;
+};
+
+// The timer built into the local APIC. Its frequency isn't architecturally
+// defined, so it is calibrated against PIT channel 2 on first use. Each CPU
+// has its own.
+class ApicTimer : public Timer {
+public:
+  ApicTimer(IoPorts* io, LocalApic* apic) : io_(io), apic_(apic) {}
+
+  void SetOneShot(uint64_t delay_ns) override;
+  void Stop() override;
+  bool HandleInterrupt(int interrupt_number) override;
+
+  static const int kVector = 48;
+
+private:
+  void Calibrate();
+
+  IoPorts* io_;
+  LocalApic* apic_;
+  uint64_t counts_per_ms_ = 0;
+};
+
+extern Timer* g_timer;
+
+#endif  // timer_h
@@ -0,0 +1,69 @@
+#include "trace.h"
+
+#include "kernel/clock.h"
+#include "kernel/cpu.h"
+#include "kernel/msr.h"
+#include "kernel/serial.h"
+#include "kernel/thread.h"
+
+static_assert((kTraceRecords & (kTraceRecords - 1)) == 0, "kTraceRecords must be a power of 2");
+
+namespace {
+
+struct TraceRing {
+  // Only the owning CPU writes. The count only ever goes up; the next record
+  // goes to count % kTraceRecords.
+  uint64_t count;
+  TraceRecord records[kTraceRecords];
+};
+
+TraceRing rings[kMaxCpus];
+
+int CurrentTid() {
+  Thread* thread = g_scheduler ? g_scheduler->current_thread() : nullptr;
+  return thread ? thread->id() : 0;
+}
+
+}  // anonymous namespace
+
+void Trace(TraceEvent event, int tid, uint64_t arg) {
+  int cpu = CurrentCpu()->index();
+  TraceRing& ring = rings[cpu];
+  uint64_t count = __atomic_load_n(&ring.count, __ATOMIC_RELAXED);
+
+  TraceRecord& record = ring.records[count % kTraceRecords];
+  record.tsc = ReadTsc();
+  record.event = event;
+  record.cpu = cpu;
+  record.tid = tid;
+  record.arg = arg;
+
+  // Publish the record before a reader can see the new count.
+  __atomic_store_n(&ring.count, count + 1, __ATOMIC_RELEASE);
+}
+
+void TraceSyscall(uint64_t number) {
+  Trace(kTraceSyscall, CurrentTid(), number);
+}
+
+void DumpTrace() {
+  // Lines are "trace <cpu> <tsc> <event> <tid> <arg>", in decimal.
+  *g_serial << "trace-begin " << (unsigned long)g_clock->tsc_per_ms() << "\n";
+
+  // Events are only traced inside the kernel, so with the kernel lock held no
+  // CPU adds any while we read.
+  for (int cpu = 0; cpu < kMaxCpus; cpu++) {
+    const TraceRing& ring = rings[cpu];
+    uint64_t end = __atomic_load_n(&ring.count, __ATOMIC_ACQUIRE);
+    uint64_t start = end > uint64_t(kTraceRecords) ? end - kTraceRecords : 0;
+
+    for (uint64_t i = start; i < end; i++) {
+      const TraceRecord& record = ring.records[i % kTraceRecords];
+      *g_serial << "trace " << int(record.cpu) << " " << (unsigned long)record.tsc << " "
+                << int(record.event) << " " << int(record.tid) << " "
+                << (unsigned long)record.arg << "\n";
+    }
+  }
+
+  *g_serial << "trace-end\n";
+}
@@ -0,0 +1,57 @@
+#ifndef trace_h
+#define trace_h
+
+#include "base/types.h"
+
+// A record of recent scheduler events, for finding out where the time went
+// after the fact. Each CPU writes its own ring of the last kTraceRecords
+// events and overwrites the oldest, without taking any lock.
+//
+// DumpTrace streams the rings over serial as text, which
+// tools/trace_to_chrome.py turns into a timeline.
+
+enum TraceEvent : uint16_t {
+  // |tid| started running in place of thread |arg|, or 0.
+  kTraceSwitch = 1,
+
+  // |tid| went on the run queue of CPU |arg|.
+  kTraceWake = 2,
+
+  // |tid| sent to, or called, thread |arg|.
+  kTraceSend = 3,
+
+  // A message from thread |arg|, or 0 for notifications, was delivered to
+  // |tid|.
+  kTraceReceive = 4,
+
+  // Interrupt vector |arg| came in while |tid| was running, and was handled.
+  kTraceIrqEnter = 5,
+  kTraceIrqExit = 6,
+
+  // |tid| made system call |arg|.
+  kTraceSyscall = 7,
+};
+
+struct TraceRecord {
+  uint64_t tsc;
+  uint16_t event;
+  uint16_t cpu;
+  int32_t tid;
+  uint64_t arg;
+};
+
+static const int kTraceRecords = 1024;
+
+// Appends an event to the ring of the calling CPU.
+void Trace(TraceEvent event, int tid, uint64_t arg);
+
+// Writes every ring to the serial port, oldest event first, one line per
+// event between a "trace-begin" and a "trace-end" line.
+void DumpTrace();
+
+extern "C" {
+// Called from the system call entry paths in interrupt_handlers.s.
+void TraceSyscall(uint64_t number);
+}
+
+#endif
@@ -0,0 +1,56 @@
+#include "work_queue.h"
+
+#include "base/assertions.h"
+#include "kernel/address_space.h"
+#include "kernel/spinlock.h"
+#include "kernel/thread.h"
+
+WorkQueue* g_work_queue;
+
+void WorkQueue::Start(AddressSpace* address_space) {
+  for (int i = 0; i < kNumWorkers; i++) {
+    Thread* thread = address_space->CreateThread(virt_addr_t(&WorkerMain), Scheduler::kIdlePriority - 1);
+    thread->SetKernelThread();
+    if (!thread->Start()) {
+      panic("Out of thread IDs");
+    }
+  }
+}
+
+void WorkQueue::Defer(DeferredWork* work, void (*func)(void* arg), void* arg) {
+  assert(!work->work_links.InList());
+  work->func = func;
+  work->arg = arg;
+  pending_.PushBack(work->work_links);
+
+  if (num_waiting_ > 0) {
+    g_scheduler->Unblock(waiting_[--num_waiting_]);
+  }
+}
+
+void WorkQueue::WorkerMain() {
+  // Kernel threads run outside the kernel lock, with interrupts on. Entering
+  // the kernel by hand means turning them off first: an interrupt taken while
+  // holding the lock would spin on it forever.
+  for (;;) {
+    asm volatile("cli" : : : "memory");
+    g_kernel_lock.Lock();
+    g_work_queue->RunOne();
+    g_kernel_lock.Unlock();
+
+    // Interrupts that came in meanwhile, and a chance to preempt us, get in
+    // after the instruction following sti.
+    asm volatile("sti; nop" : : : "memory");
+  }
+}
+
+void WorkQueue::RunOne() {
+  while (pending_.IsEmpty()) {
+    assert_lt(num_waiting_, kNumWorkers);
+    waiting_[num_waiting_++] = g_scheduler->current_thread();
+    g_scheduler->Block();
+  }
+
+  DeferredWork* work = pending_.PopFront();
+  work->func(work->arg);
+}
@@ -0,0 +1,50 @@
+#ifndef work_queue_h
+#define work_queue_h
+
+#include "base/linked_list.h"
+#include "base/types.h"
+
+class AddressSpace;
+class Thread;
+
+// Something the kernel does later, on a worker thread, rather than in the
+// interrupt or system call that came up with it. Embed one in whatever the
+// work is about.
+struct DeferredWork {
+  LinkedListEntry work_links;
+  void (*func)(void* arg) = nullptr;
+  void* arg = nullptr;
+};
+
+// Work that is not urgent, such as freeing what a thread left behind, runs
+// on low priority kernel threads. They only get the CPU once nothing else
+// wants it, and they let go of the kernel lock between items.
+class WorkQueue {
+public:
+  // Starts the worker threads in |address_space|, which must have the kernel
+  // mappings only.
+  void Start(AddressSpace* address_space);
+
+  // Queues func(arg) to be run by a worker. |work| must stay around until
+  // then, and can't be queued twice.
+  void Defer(DeferredWork* work, void (*func)(void* arg), void* arg);
+
+  static const int kNumWorkers = 2;
+
+private:
+  // Entry point of the worker threads.
+  static void WorkerMain();
+
+  // Runs the oldest item, waiting for one if there is none.
+  void RunOne();
+
+  LINKED_LIST(DeferredWork, work_links) pending_;
+
+  // Workers blocked in RunOne.
+  Thread* waiting_[kNumWorkers] = {};
+  int num_waiting_ = 0;
+};
+
+extern WorkQueue* g_work_queue;
+
+#endif
@@ -1,7 +1,29 @@
 #include "base/output_stream.h"
+#include "usr/channel.h"
 #include "usr/keyboard.h"
 #include "usr/system.h"
 
+static const int kConsoleTid = 1;
+
+// Output goes to the console through a channel, so typing doesn't wait for it
+// to draw.
+static char console_ring[kPageSize] __attribute__((aligned(kPageSize)));
+
+// Writes up to kMaxMessageWords characters to the console in one message.
+static void WriteToConsole(ChannelWriter* console, const char* str) {
+  Message msg;
+  int length = 0;
+  while (str[length] && length < kMaxMessageWords) {
+    msg.words[length] = str[length];
+    length++;
+  }
+  msg.set_tag(0, length);
+
+  while (!console->Write(msg)) {
+    SysReschedule();
+  }
+}
+
 class DebugOutputStream : public OutputStream {
 public:
   void OutputChar(char c) override {
@@ -14,67 +36,60 @@ void _start() {
   DebugOutputStream stream;
   stream.Printf("test_program: Hello from the test program!\n");
 
+  ChannelWriter console(console_ring, sizeof(console_ring));
+  console.Open(kConsoleTid);
+
   for (;;) {
     // Request a key
-    SysSend(2, 0, 0);
-
-    int sender, type;
-    uint64_t payload;
-    SysReceive(&sender, &type, &payload);
+    Message msg;
+    SysCall(2, &msg);
 
-    KeyEvent key_event(payload);
+    KeyEvent key_event(msg.words[0]);
 
     if (key_event.type == kKeyDownEvent) {
       switch (key_event.key.type) {
         case kTypeNumber:
         case kTypeLetter:
         case kTypeSymbol:
-        case kTypeKeypad:
-          SysSend(1, 0, key_event.key.data);
+        case kTypeKeypad: {
+          char str[] = {char(key_event.key.data), '\0'};
+          WriteToConsole(&console, str);
           break;
+        }
 
         case kTypeNamedKey:
           switch (key_event.key.data) {
             case kKeyBackspace:
               stream.Printf("BACKSPACE\n");
-              SysSend(1, 0, '\b');
+              WriteToConsole(&console, "\b");
               break;
 
             case kKeyTab:
-              SysSend(1, 0, '\t');
+              WriteToConsole(&console, "\t");
               break;
 
             case kKeyEnter:
-              SysSend(1, 0, '\r');
-              SysSend(1, 0, '\n');
+              WriteToConsole(&console, "\r\n");
               break;
 
             case kKeySpace:
-              SysSend(1, 0, ' ');
+              WriteToConsole(&console, " ");
               break;
 
             case kKeyLeft:
-              SysSend(1, 0, '\e');
-              SysSend(1, 0, '[');
-              SysSend(1, 0, 'D');
+              WriteToConsole(&console, "\e[D");
               break;
 
             case kKeyRight:
-              SysSend(1, 0, '\e');
-              SysSend(1, 0, '[');
-              SysSend(1, 0, 'C');
+              WriteToConsole(&console, "\e[C");
               break;
 
             case kKeyUp:
-              SysSend(1, 0, '\e');
-              SysSend(1, 0, '[');
-              SysSend(1, 0, 'A');
+              WriteToConsole(&console, "\e[A");
               break;
 
             case kKeyDown:
-              SysSend(1, 0, '\e');
-              SysSend(1, 0, '[');
-              SysSend(1, 0, 'B');
+              WriteToConsole(&console, "\e[B");
               break;
 
             default:
@@ -0,0 +1,82 @@
+#include "batch.h"
+
+#include "base/assertions.h"
+
+Batch::Batch(BatchRing* ring) : ring_(ring) {
+  assert_eq(uintptr_t(ring) & (kPageSize - 1), 0);
+  ring_->sq_head = 0;
+  ring_->sq_tail = 0;
+  ring_->cq_head = 0;
+  ring_->cq_tail = 0;
+}
+
+BatchSubmission* Batch::Queue(BatchOpcode opcode, int target, uint64_t user_data, bool quiet) {
+  uint32_t tail = ring_->sq_tail;
+  if (tail - __atomic_load_n(&ring_->sq_head, __ATOMIC_ACQUIRE) == kBatchEntries) {
+    return nullptr;
+  }
+
+  BatchSubmission* op = &ring_->submissions[tail % kBatchEntries];
+  op->opcode = opcode;
+  op->flags = quiet ? kBatchQuiet : 0;
+  op->target = target;
+  op->user_data = user_data;
+  return op;
+}
+
+bool Batch::Send(int dest_tid, const Message& msg, uint64_t user_data, bool quiet) {
+  BatchSubmission* op = Queue(kBatchSend, dest_tid, user_data, quiet);
+  if (!op) return false;
+
+  op->args[0] = msg.tag;
+  for (int i = 0; i < kMaxMessageWords; i++) {
+    op->args[1 + i] = msg.words[i];
+  }
+  __atomic_store_n(&ring_->sq_tail, ring_->sq_tail + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+bool Batch::Notify(int notify_tid, uint64_t bits, uint64_t user_data, bool quiet) {
+  BatchSubmission* op = Queue(kBatchNotify, notify_tid, user_data, quiet);
+  if (!op) return false;
+
+  op->args[0] = bits;
+  __atomic_store_n(&ring_->sq_tail, ring_->sq_tail + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+bool Batch::AckInterrupt(int irq, uint64_t user_data, bool quiet) {
+  BatchSubmission* op = Queue(kBatchAckInterrupt, irq, user_data, quiet);
+  if (!op) return false;
+
+  __atomic_store_n(&ring_->sq_tail, ring_->sq_tail + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+bool Batch::UnmapShared(void* addr, size_t size, uint64_t user_data, bool quiet) {
+  BatchSubmission* op = Queue(kBatchUnmapShared, 0, user_data, quiet);
+  if (!op) return false;
+
+  op->args[0] = uint64_t(addr);
+  op->args[1] = size;
+  __atomic_store_n(&ring_->sq_tail, ring_->sq_tail + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+int Batch::Submit() {
+  if (ring_->sq_tail == __atomic_load_n(&ring_->sq_head, __ATOMIC_ACQUIRE)) {
+    return 0;
+  }
+  return SysSubmitBatch(ring_);
+}
+
+bool Batch::NextCompletion(BatchCompletion* completion) {
+  uint32_t head = ring_->cq_head;
+  if (head == __atomic_load_n(&ring_->cq_tail, __ATOMIC_ACQUIRE)) {
+    return false;
+  }
+
+  *completion = ring_->completions[head % kBatchEntries];
+  __atomic_store_n(&ring_->cq_head, head + 1, __ATOMIC_RELEASE);
+  return true;
+}
@@ -0,0 +1,83 @@
+#ifndef batch_h
+#define batch_h
+
+#include "base/types.h"
+#include "usr/system.h"
+
+// Queues system calls in a page shared with the kernel and runs them all with
+// one trip into the kernel, for tasks that make several calls in a row. The
+// calls in a batch never block: a send the receiver isn't waiting for
+// completes with kWouldBlock, and threads woken up by the batch only run once
+// it's done.
+//
+// The layout is shared with the kernel. Warning: Any changes to it must be
+// reflected in kernel/batch.h.
+
+static const uint32_t kBatchEntries = 32;
+
+enum BatchOpcode {
+  kBatchSend = 1,
+  kBatchNotify = 2,
+  kBatchAckInterrupt = 3,
+  kBatchUnmapShared = 4,
+};
+
+// Don't post a completion.
+static const uint16_t kBatchQuiet = 1;
+
+// What an unknown opcode completes with.
+static const int kBatchBadOpcode = -3;
+
+struct BatchSubmission {
+  uint16_t opcode;
+  uint16_t flags;
+  int32_t target;
+  uint64_t user_data;
+  uint64_t args[1 + kMaxMessageWords];
+};
+
+struct BatchCompletion {
+  uint64_t user_data;
+  int64_t result;
+};
+
+struct BatchRing {
+  uint32_t sq_head;
+  uint32_t sq_tail;
+  uint32_t cq_head;
+  uint32_t cq_tail;
+  BatchSubmission submissions[kBatchEntries];
+  BatchCompletion completions[kBatchEntries];
+};
+
+static_assert(sizeof(BatchRing) <= kPageSize, "The batch ring must fit in a page");
+
+class Batch {
+public:
+  // |ring| must start on a page boundary. It should only be used by one
+  // thread at a time.
+  explicit Batch(BatchRing* ring);
+
+  // Queue a call. With |quiet| set, no completion is posted for it. Return
+  // false if the ring is full; Submit empties it.
+  bool Send(int dest_tid, const Message& msg, uint64_t user_data = 0, bool quiet = false);
+  bool Notify(int notify_tid, uint64_t bits, uint64_t user_data = 0, bool quiet = false);
+  bool AckInterrupt(int irq, uint64_t user_data = 0, bool quiet = false);
+  bool UnmapShared(void* addr, size_t size, uint64_t user_data = 0, bool quiet = false);
+
+  // Runs the queued calls. Returns how many ran. Calls that post completions
+  // stay queued while the completion queue is full.
+  int Submit();
+
+  // Takes the next completion, in submission order. Returns false if there
+  // is none.
+  bool NextCompletion(BatchCompletion* completion);
+
+private:
+  // Returns the next free submission slot, or nullptr if there is none.
+  BatchSubmission* Queue(BatchOpcode opcode, int target, uint64_t user_data, bool quiet);
+
+  BatchRing* ring_;
+};
+
+#endif
@@ -0,0 +1,98 @@
+#include "channel.h"
+
+#include "base/assertions.h"
+
+ChannelWriter::ChannelWriter(void* memory, size_t size)
+  : memory_(memory),
+    size_(size),
+    header_(static_cast<ChannelHeader*>(memory)),
+    slots_(reinterpret_cast<Message*>(header_ + 1)) {
+  assert_eq(uintptr_t(memory) & (kPageSize - 1), 0);
+  assert_eq(size & (kPageSize - 1), 0);
+
+  uint64_t capacity = 1;
+  while (sizeof(ChannelHeader) + 2 * capacity * sizeof(Message) <= size) {
+    capacity *= 2;
+  }
+
+  header_->head = 0;
+  header_->tail = 0;
+  header_->capacity = capacity;
+}
+
+void ChannelWriter::Open(int reader_tid, uint64_t doorbell) {
+  reader_tid_ = reader_tid;
+  doorbell_ = doorbell;
+
+  Message msg;
+  msg.SetLong(kMsgOpenChannel, memory_, size_);
+  msg.tag |= Message::kShared;
+  SysSendMessage(reader_tid, &msg);
+}
+
+bool ChannelWriter::Write(const Message& msg) {
+  uint64_t tail = header_->tail;
+  if (tail - __atomic_load_n(&header_->head, __ATOMIC_ACQUIRE) == header_->capacity) {
+    return false;
+  }
+
+  slots_[tail & (header_->capacity - 1)] = msg;
+
+  // Publishing the slot has to happen before looking at head, and the reader
+  // does the opposite, so one of us always sees the other's update and a
+  // wakeup can't get lost.
+  __atomic_store_n(&header_->tail, tail + 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&header_->head, __ATOMIC_SEQ_CST) == tail) {
+    SysNotify(reader_tid_, doorbell_);
+  }
+
+  return true;
+}
+
+bool ChannelReader::Attach(int sender, const Message& msg) {
+  if (msg.type() != kMsgOpenChannel || !msg.is_shared() ||
+      msg.buffer_size() < sizeof(ChannelHeader) + sizeof(Message)) {
+    return false;
+  }
+
+  ChannelHeader* header = static_cast<ChannelHeader*>(msg.buffer());
+
+  // Keep our own copy of the capacity so the writer can't make us read past
+  // the end of the memory.
+  uint64_t capacity = header->capacity;
+  if (capacity == 0 || (capacity & (capacity - 1)) ||
+      capacity > (msg.buffer_size() - sizeof(ChannelHeader)) / sizeof(Message)) {
+    return false;
+  }
+
+  if (is_attached()) {
+    Detach();
+  }
+
+  header_ = header;
+  size_ = msg.buffer_size();
+  slots_ = reinterpret_cast<Message*>(header + 1);
+  capacity_ = capacity;
+  writer_tid_ = sender;
+  return true;
+}
+
+void ChannelReader::Detach() {
+  SysUnmapShared(header_, size_);
+  header_ = nullptr;
+  size_ = 0;
+  slots_ = nullptr;
+  capacity_ = 0;
+  writer_tid_ = 0;
+}
+
+bool ChannelReader::Read(Message* msg) {
+  uint64_t head = header_->head;
+  if (__atomic_load_n(&header_->tail, __ATOMIC_SEQ_CST) == head) {
+    return false;
+  }
+
+  *msg = slots_[head & (capacity_ - 1)];
+  __atomic_store_n(&header_->head, head + 1, __ATOMIC_SEQ_CST);
+  return true;
+}
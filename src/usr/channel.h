@@ -0,0 +1,89 @@
+#ifndef channel_h
+#define channel_h
+
+#include "base/types.h"
+#include "usr/system.h"
+
+// A one-way channel from one thread to another that doesn't block the writer.
+// Messages go through a ring buffer in memory shared by both threads, and the
+// writer only notifies the reader when the ring goes from empty to non-empty,
+// so the reader picks up whatever piled up by then in one wakeup.
+//
+// The writer owns the memory and hands it to the reader with Open. The reader
+// sees a long message of type kMsgOpenChannel with Message::kShared set and
+// passes the message to ChannelReader::Attach.
+
+static const int kMsgOpenChannel = 0x43484e4c;
+
+// The notification bit writers ring unless told otherwise. Away from the low
+// bits, which belong to IRQs.
+static const uint64_t kChannelDoorbell = uint64_t(1) << 63;
+
+// The part at the start of the shared memory. The slots follow.
+struct ChannelHeader {
+  // Next slot to read. Only written by the reader.
+  uint64_t head;
+  char head_padding[56];
+
+  // Next slot to write. Only written by the writer.
+  uint64_t tail;
+  char tail_padding[56];
+
+  // Number of slots, a power of two.
+  uint64_t capacity;
+  char capacity_padding[56];
+};
+
+class ChannelWriter {
+public:
+  // |memory| must start on a page boundary and be a multiple of the page
+  // size. It holds the ring from now on.
+  ChannelWriter(void* memory, size_t size);
+
+  // Shares the ring with |reader_tid|. Blocks until the reader receives it.
+  // Writes notify the reader with |doorbell|.
+  void Open(int reader_tid, uint64_t doorbell = kChannelDoorbell);
+
+  // Queues |msg| and notifies the reader if it may be waiting. Returns false
+  // if the ring is full.
+  bool Write(const Message& msg);
+
+private:
+  void* memory_;
+  size_t size_;
+  ChannelHeader* header_;
+  Message* slots_;
+  int reader_tid_ = 0;
+  uint64_t doorbell_ = 0;
+};
+
+class ChannelReader {
+public:
+  ChannelReader() {}
+
+  // Takes the ring from a kMsgOpenChannel message from |sender|. There is
+  // one writer at a time, the last to open, so the ring taken before is
+  // unmapped. Returns false, keeping that ring, if |msg| doesn't carry one.
+  bool Attach(int sender, const Message& msg);
+
+  // Unmaps the ring.
+  void Detach();
+
+  bool is_attached() const { return header_ != nullptr; }
+
+  // The thread that opened the ring, or 0 if there is none.
+  int writer_tid() const { return writer_tid_; }
+
+  // Takes the next message off the ring. Returns false once it is empty, after
+  // which the writer notifies the thread on the next Write.
+  bool Read(Message* msg);
+
+private:
+  ChannelHeader* header_ = nullptr;
+  size_t size_ = 0;
+  Message* slots_ = nullptr;
+  uint64_t capacity_ = 0;
+  int writer_tid_ = 0;
+};
+
+#endif  // channel_h
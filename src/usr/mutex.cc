@@ -0,0 +1,27 @@
+#include "mutex.h"
+
+#include "usr/system.h"
+
+void Mutex::Lock() {
+  if (TryLock()) return;
+
+  // From now on, whoever holds the lock has to wake someone up when letting
+  // go of it, so mark it contended whenever we take it.
+  uint32_t state = __atomic_exchange_n(&state_, kContended, __ATOMIC_ACQUIRE);
+  while (state != kUnlocked) {
+    SysFutexWait(&state_, kContended, kNoTimeout);
+    state = __atomic_exchange_n(&state_, kContended, __ATOMIC_ACQUIRE);
+  }
+}
+
+bool Mutex::TryLock() {
+  uint32_t expected = kUnlocked;
+  return __atomic_compare_exchange_n(&state_, &expected, kLocked, false,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+void Mutex::Unlock() {
+  if (__atomic_exchange_n(&state_, kUnlocked, __ATOMIC_RELEASE) == kContended) {
+    SysFutexWake(&state_, 1);
+  }
+}
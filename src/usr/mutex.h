@@ -0,0 +1,35 @@
+#ifndef mutex_h
+#define mutex_h
+
+#include "base/types.h"
+
+// A lock for the threads of a task, or of tasks sharing the memory it lives
+// in. Taking and releasing a free lock stays in user space; only threads that
+// have to wait for it enter the kernel, through SysFutexWait.
+class Mutex {
+public:
+  void Lock();
+  bool TryLock();
+  void Unlock();
+
+private:
+  enum State : uint32_t {
+    kUnlocked = 0,
+    kLocked = 1,
+    // Locked, and someone may be waiting in the kernel.
+    kContended = 2,
+  };
+
+  uint32_t state_ = kUnlocked;
+};
+
+class MutexLock {
+public:
+  explicit MutexLock(Mutex* mutex) : mutex_(mutex) { mutex_->Lock(); }
+  ~MutexLock() { mutex_->Unlock(); }
+
+private:
+  Mutex* mutex_;
+};
+
+#endif
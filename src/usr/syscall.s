@@ -1,10 +1,22 @@
 ; Syscall number will be in RAX.
-; Arguments will be in RDI, RSI, RDX, RCX, R8, R9
+; Arguments will be in RDI, RSI, RDX, RCX, R8, R9.
+; The syscall instruction overwrites RCX, so the fourth argument goes in R10
+; instead. It also clobbers R11.
 
 section .text
 
 %macro gen_syscall 2
 global Sys%1
+Sys%1:
+  mov rax, %2
+  mov r10, rcx
+  syscall
+  ret
+%endmacro
+
+; The older, slower entry path through the interrupt gate.
+%macro gen_int80_syscall 2
+global Sys%1
 Sys%1:
   mov rax, %2
   int 0x80
@@ -14,8 +26,167 @@ Sys%1:
 gen_syscall WriteByte, 1
 gen_syscall Reschedule, 2
 gen_syscall ExitThread, 3
-gen_syscall Send, 4
-gen_syscall Receive, 5
 gen_syscall Notify, 6
 gen_syscall RequestInterrupt, 7
 gen_syscall AckInterrupt, 8
+gen_syscall SetPriority, 9
+gen_syscall YieldToPriority, 10
+gen_syscall Sleep, 11
+gen_syscall Nop, 13
+gen_int80_syscall NopInt80, 13
+gen_syscall SetReceiveBuffer, 16
+gen_syscall UnmapShared, 17
+gen_syscall CreateThread, 21
+gen_syscall SubmitBatch, 22
+gen_syscall FutexWait, 23
+gen_syscall FutexWake, 24
+gen_syscall GetThreadStats, 25
+gen_syscall DumpTrace, 26
+
+; Message passing. The tag goes in RSI and the words in RDX, R10, R8, R9, R12
+; and R13, the same way in both directions (thread.h). R12 and R13 are
+; callee-saved, so the stubs below preserve them, as well as R14, which carries
+; timeouts.
+
+; Loads the Message at %1 into the message registers. %1 must not be one of
+; them, except RSI.
+%macro load_message 1
+  mov rdx, qword[%1 + 8]
+  mov r10, qword[%1 + 16]
+  mov r8, qword[%1 + 24]
+  mov r9, qword[%1 + 32]
+  mov r12, qword[%1 + 40]
+  mov r13, qword[%1 + 48]
+  mov rsi, qword[%1]
+%endmacro
+
+; Stores the message registers to the Message at %1.
+%macro store_message 1
+  mov qword[%1], rsi
+  mov qword[%1 + 8], rdx
+  mov qword[%1 + 16], r10
+  mov qword[%1 + 24], r8
+  mov qword[%1 + 32], r9
+  mov qword[%1 + 40], r12
+  mov qword[%1 + 48], r13
+%endmacro
+
+; void SysSendMessage(int dest_tid, const Message* msg)
+global SysSendMessage
+SysSendMessage:
+  push r12
+  push r13
+  load_message rsi
+  mov rax, 4
+  syscall
+  pop r13
+  pop r12
+  ret
+
+; int SysReceiveMessage(Message* msg)
+global SysReceiveMessage
+SysReceiveMessage:
+  push r12
+  push r13
+  push rdi
+  mov rax, 5
+  syscall
+  pop rcx                       ; syscall clobbered rcx anyway.
+  store_message rcx
+  pop r13
+  pop r12
+  ret
+
+; int SysReceiveMessageTimeout(Message* msg, uint64_t timeout_ns)
+global SysReceiveMessageTimeout
+SysReceiveMessageTimeout:
+  push r12
+  push r13
+  push rdi
+  mov rdi, rsi
+  mov rax, 12
+  syscall
+  pop rcx
+  store_message rcx
+  pop r13
+  pop r12
+  ret
+
+; int SysSendMessageTimeout(int dest_tid, const Message* msg, uint64_t timeout_ns)
+; The timeout goes in R14.
+global SysSendMessageTimeout
+SysSendMessageTimeout:
+  push r12
+  push r13
+  push r14
+  mov r14, rdx
+  load_message rsi
+  mov rax, 18
+  syscall
+  pop r14
+  pop r13
+  pop r12
+  ret
+
+; int SysReceiveMessageFiltered(Message* msg, int from_tid, int type, uint64_t timeout_ns)
+global SysReceiveMessageFiltered
+SysReceiveMessageFiltered:
+  push r12
+  push r13
+  push rdi
+  mov rdi, rcx
+  mov rax, 20
+  syscall
+  pop rcx
+  store_message rcx
+  pop r13
+  pop r12
+  ret
+
+; int SysCall(int dest_tid, Message* msg)
+global SysCall
+SysCall:
+  push r12
+  push r13
+  push rsi
+  load_message rsi
+  mov rax, 14
+  syscall
+  pop rcx
+  store_message rcx
+  pop r13
+  pop r12
+  ret
+
+; int SysCallTimeout(int dest_tid, Message* msg, uint64_t timeout_ns)
+global SysCallTimeout
+SysCallTimeout:
+  push r12
+  push r13
+  push r14
+  push rsi
+  mov r14, rdx
+  load_message rsi
+  mov rax, 19
+  syscall
+  pop rcx
+  store_message rcx
+  pop r14
+  pop r13
+  pop r12
+  ret
+
+; int SysReplyWait(int reply_tid, const Message* reply, Message* msg)
+global SysReplyWait
+SysReplyWait:
+  push r12
+  push r13
+  push rdx
+  load_message rsi
+  mov rax, 15
+  syscall
+  pop rcx
+  store_message rcx
+  pop r13
+  pop r12
+  ret
@@ -3,17 +3,202 @@
 
 #include "base/types.h"
 
+// Messages are passed in registers, so they hold at most this many words.
+static const int kMaxMessageWords = 6;
+
+struct Message {
+  // The type in the low 32 bits, the number of words in the next 16 bits and
+  // the flags below on top.
+  uint64_t tag = 0;
+  uint64_t words[kMaxMessageWords] = {};
+
+  // The message names a buffer: words[0] is the address and words[1] the
+  // size. The receiver gets the address of its copy and the number of bytes
+  // that arrived there instead.
+  static const uint64_t kLong = uint64_t(1) << 63;
+
+  // Set on a received long message if the kernel mapped the sender's pages
+  // instead of copying them. Release them with SysUnmapShared. Senders set it
+  // to share page-aligned memory of any size; if that fails, nothing is
+  // delivered and the size is 0. Only pages shared that way are writable for
+  // the receiver.
+  static const uint64_t kShared = uint64_t(1) << 62;
+
+  int type() const { return int(tag & 0xffffffff); }
+  int length() const { return int((tag >> 32) & 0xffff); }
+  bool is_long() const { return tag & kLong; }
+  bool is_shared() const { return tag & kShared; }
+  void set_tag(int type, int length) { tag = (uint64_t(length) << 32) | uint32_t(type); }
+
+  void SetLong(int type, const void* buffer, size_t size) {
+    set_tag(type, 2);
+    tag |= kLong;
+    words[0] = uint64_t(buffer);
+    words[1] = size;
+  }
+
+  void* buffer() const { return reinterpret_cast<void*>(words[0]); }
+  size_t buffer_size() const { return words[1]; }
+};
+
+// Long messages at least this big are shared instead of copied, if the
+// buffer starts on a page boundary. The pages holding the buffer become
+// visible to the receiver, read-only, so it should end on one too.
+static const size_t kShareThreshold = 16 * 1024;
+
+// What a thread used so far, from SysGetThreadStats. Times are in
+// nanoseconds. Matches ThreadStatsRecord in kernel/thread.h.
+struct ThreadStatsRecord {
+  int32_t tid;
+  int32_t priority;
+  int32_t cpu;
+
+  // Thread::Status in kernel/thread.h. 2 is running, 1 waiting for a CPU.
+  int32_t status;
+
+  uint64_t run_ns;
+  uint64_t wait_ns;
+
+  // Switches away from the thread because it blocked, and because something
+  // else took the CPU while it could have kept running.
+  uint64_t voluntary_switches;
+  uint64_t involuntary_switches;
+
+  uint64_t messages_sent;
+  uint64_t messages_received;
+};
+
 extern "C" {
 void SysWriteByte(char c);
 void SysReschedule();
 void SysExitThread();
 
-void SysSend(int dest_tid, int type, uint64_t payload);
-void SysReceive(int* sender_tid, int* type, uint64_t* payload);
-void SysNotify(int notify_tid);
+void SysSendMessage(int dest_tid, const Message* msg);
+
+// Returns the sender's thread ID, or 0 for a notification. Words past the
+// length of the message are zero.
+int SysReceiveMessage(Message* msg);
+
+// Sets |bits| in the notification word of |notify_tid|. Its next receive
+// returns a message from thread 0 with all the bits set since the last one
+// in words[0] and clears them. IRQ N sets bit N.
+void SysNotify(int notify_tid, uint64_t bits);
+
+// Sends |msg| to |dest_tid| and waits for its reply, in one kernel entry. The
+// reply overwrites |msg|.
+int SysCall(int dest_tid, Message* msg);
+
+// Replies to a thread waiting in SysCall, then waits for the next message
+// like SysReceiveMessage. The reply is dropped if |reply_tid| isn't waiting
+// for one.
+int SysReplyWait(int reply_tid, const Message* reply, Message* msg);
+
+// Long messages sent to the calling thread are copied to |buffer|. Whatever
+// doesn't fit is dropped.
+void SysSetReceiveBuffer(void* buffer, size_t size);
+
+// Unmaps the pages of a long message received with Message::kShared.
+bool SysUnmapShared(void* addr, size_t size);
 
 void SysRequestInterrupt(int irq);
 void SysAckInterrupt(int irq);
+
+// Priority 0 is the most urgent; 63 is reserved for the idle thread. Up to
+// 47, priorities are strict. Threads at 48 to 62 run only when no thread at a
+// strict priority wants to run. They share the CPU instead of waiting for
+// one another, each getting about a fifth less time than a thread one step
+// more urgent. At most 1024 threads may have fair priorities.
+//
+// Returns false, changing nothing, if |priority| is out of range, |tid| isn't
+// a thread, or it would be one fair thread too many.
+bool SysSetPriority(int tid, int priority);
+void SysYieldToPriority(int priority);
+
+// Blocks the calling thread for at least |ns| nanoseconds. Returns 0, or
+// kTooManyTimeouts without sleeping.
+int SysSleep(uint64_t ns);
+
+// Timed variants of the message passing calls. They give up after
+// |timeout_ns| nanoseconds and return kTimedOut. With a timeout of 0 they
+// poll instead: if the call would have to wait, it returns kWouldBlock at
+// once. Sends return 0 once the message is delivered.
+//
+// Each CPU keeps track of at most 1024 pending timeouts. Past that, these
+// calls and SysSleep return kTooManyTimeouts instead of waiting.
+//
+// Sends and calls to a thread that doesn't exist, or exited, return
+// kNoSuchThread.
+int SysSendMessageTimeout(int dest_tid, const Message* msg, uint64_t timeout_ns);
+int SysReceiveMessageTimeout(Message* msg, uint64_t timeout_ns);
+
+// The timeout covers the request and the reply. A call always has to wait
+// for the reply, so with a timeout of 0 it returns kWouldBlock without
+// sending anything.
+int SysCallTimeout(int dest_tid, Message* msg, uint64_t timeout_ns);
+
+// Like SysReceiveMessageTimeout, but only takes messages from |from_tid|,
+// unless it is 0, and only of |type|, unless it is kAnyType. Notifications
+// wait for an unfiltered receive. Queued messages are taken most urgent
+// sender first either way.
+int SysReceiveMessageFiltered(Message* msg, int from_tid, int type, uint64_t timeout_ns);
+
+// Starts a thread in the calling address space at |priority|. |entry| gets a
+// pointer to a copy of |arg| and must end with SysExitThread. Returns the
+// thread ID, or 0 if the priority is out of range, the kernel is out of
+// thread IDs, or |priority| is fair and there are 1024 fair threads already.
+int SysCreateThread(void (*entry)(uint64_t* arg), int priority, uint64_t arg);
+
+// Runs the calls queued in a BatchRing. See usr/batch.h. Returns how many
+// ran, or -1 if |ring| isn't a writable page.
+int SysSubmitBatch(struct BatchRing* ring);
+
+// Blocks until SysFutexWake on |addr|, if the word there still holds
+// |expected| at the time of the call. Threads of different tasks meet on a
+// word in memory they share. Returns 0 once woken up, kWouldBlock if the word
+// held something else, kTimedOut, kTooManyTimeouts, or kFutexFault for an
+// unmapped or unaligned address.
+int SysFutexWait(uint32_t* addr, uint32_t expected, uint64_t timeout_ns);
+
+// Wakes up to |count| threads waiting on |addr|, most urgent first. Returns
+// how many woke up, or kFutexFault.
+int SysFutexWake(uint32_t* addr, int count);
+
+// Copies a record for each thread, up to |max_records| of them, to
+// |records|. Returns the number of threads, which may be more than were
+// copied, or -1 if |records| isn't writable.
+int SysGetThreadStats(struct ThreadStatsRecord* records, int max_records);
+
+// Writes the kernel's trace of recent scheduler events to the serial port.
+// tools/trace_to_chrome.py turns it into a timeline.
+void SysDumpTrace();
+
+// Does nothing. For measuring the cost of entering the kernel through the
+// syscall instruction and through int 0x80.
+void SysNop();
+void SysNopInt80();
+}
+
+static const uint64_t kNoTimeout = UINT64_MAX;
+static const int kTimedOut = -1;
+static const int kWouldBlock = -2;
+static const int kFutexFault = -3;
+static const int kNoSuchThread = -4;
+static const int kTooManyTimeouts = -5;
+static const int kAnyType = -1;
+
+// Shorthands for messages of one word.
+inline void SysSend(int dest_tid, int type, uint64_t payload) {
+  Message msg;
+  msg.set_tag(type, 1);
+  msg.words[0] = payload;
+  SysSendMessage(dest_tid, &msg);
+}
+
+inline void SysReceive(int* sender_tid, int* type, uint64_t* payload) {
+  Message msg;
+  *sender_tid = SysReceiveMessage(&msg);
+  *type = msg.type();
+  *payload = msg.words[0];
 }
 
 #endif
@@ -0,0 +1,117 @@
+#!/usr/bin/env python3
+"""Turns a scheduler trace from the serial log into Chrome trace JSON.
+
+The kernel writes its trace rings (kernel/trace.h) on SysDumpTrace as
+
+    trace-begin <tsc ticks per ms>
+    trace <cpu> <tsc> <event> <tid> <arg>
+    ...
+    trace-end
+
+Anything else in the log is skipped. If the log holds more than one dump,
+the last one is used. Load the output in chrome://tracing or Perfetto: every
+CPU is a row, with the thread it ran as slices, interrupts nested in them and
+the other events as markers.
+
+Usage: trace_to_chrome.py serial.log > trace.json
+"""
+
+import json
+import sys
+
+SWITCH = 1
+WAKE = 2
+SEND = 3
+RECEIVE = 4
+IRQ_ENTER = 5
+IRQ_EXIT = 6
+SYSCALL = 7
+
+MARKERS = {
+    WAKE: ('wake', 'tid {tid} onto cpu {arg}'),
+    SEND: ('send', 'tid {tid} to {arg}'),
+    RECEIVE: ('receive', 'tid {tid} from {arg}'),
+    SYSCALL: ('syscall', 'tid {tid}: syscall {arg}'),
+}
+
+
+def read_dump(lines):
+    tsc_per_ms = None
+    records = None
+    result = None
+    for line in lines:
+        fields = line.split()
+        if not fields:
+            continue
+        if fields[0] == 'trace-begin' and len(fields) == 2:
+            tsc_per_ms = int(fields[1])
+            records = []
+        elif fields[0] == 'trace' and len(fields) == 6 and records is not None:
+            records.append(tuple(int(f) for f in fields[1:]))
+        elif fields[0] == 'trace-end' and records is not None:
+            result = (tsc_per_ms, records)
+            records = None
+    return result
+
+
+def convert(tsc_per_ms, records):
+    records.sort(key=lambda r: (r[0], r[1]))
+    start = min(r[1] for r in records)
+
+    def micros(tsc):
+        return (tsc - start) * 1000.0 / tsc_per_ms
+
+    events = []
+    cpus = sorted(set(r[0] for r in records))
+    for cpu in cpus:
+        events.append({'ph': 'M', 'name': 'thread_name', 'pid': 0, 'tid': cpu,
+                       'args': {'name': 'cpu %d' % cpu}})
+
+    # The thread each CPU is running, and since when.
+    running = {}
+    last = {}
+    for cpu, tsc, event, tid, arg in records:
+        last[cpu] = tsc
+        if event == SWITCH:
+            if cpu in running:
+                run_tid, run_start = running[cpu]
+                events.append({'ph': 'X', 'name': 'tid %d' % run_tid, 'cat': 'run',
+                               'pid': 0, 'tid': cpu, 'ts': micros(run_start),
+                               'dur': micros(tsc) - micros(run_start)})
+            running[cpu] = (tid, tsc)
+        elif event in (IRQ_ENTER, IRQ_EXIT):
+            events.append({'ph': 'B' if event == IRQ_ENTER else 'E',
+                           'name': 'irq %d' % arg, 'cat': 'irq',
+                           'pid': 0, 'tid': cpu, 'ts': micros(tsc)})
+        elif event in MARKERS:
+            category, name = MARKERS[event]
+            events.append({'ph': 'i', 's': 't', 'name': name.format(tid=tid, arg=arg),
+                           'cat': category, 'pid': 0, 'tid': cpu, 'ts': micros(tsc)})
+
+    # Threads still running at the end of the trace.
+    for cpu, (run_tid, run_start) in running.items():
+        events.append({'ph': 'X', 'name': 'tid %d' % run_tid, 'cat': 'run',
+                       'pid': 0, 'tid': cpu, 'ts': micros(run_start),
+                       'dur': micros(last[cpu]) - micros(run_start)})
+
+    return {'traceEvents': events, 'displayTimeUnit': 'ns'}
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.stderr.write(__doc__)
+        sys.exit(1)
+
+    with open(sys.argv[1], errors='replace') as f:
+        dump = read_dump(f)
+
+    if not dump or not dump[1]:
+        sys.stderr.write('No trace found in %s\n' % sys.argv[1])
+        sys.exit(1)
+
+    json.dump(convert(*dump), sys.stdout)
+    sys.stdout.write('\n')
+
+
+if __name__ == '__main__':
+    main()